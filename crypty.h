@@ -0,0 +1,104 @@
+/* ======== libcrypty: embeddable scanner, C ABI ========
+ * The scanner of find_sig.exe as a library: load a signature into an
+ * engine once, then scan paths, open descriptors or memory on the calling
+ * thread, or submit scans to the engine's thread pool and get the verdict
+ * through a callback.
+ *
+ * Build: g++ -std=c++17 -pthread -O2 -fPIC -shared -fvisibility=hidden \
+ *            -DCRYPTY_LIBRARY -o libcrypty.so find_sig.cpp
+ *
+ * Thread safety: all state lives in the engine; engines are independent
+ * and any number may exist in one process. Every function except
+ * crypty_engine_destroy may be called on the same engine from any number
+ * of threads at once. Callbacks run on the engine's pool threads, possibly
+ * several at a time; they may scan and submit on their own engine but must
+ * not call crypty_wait or crypty_engine_destroy on it. The library never
+ * writes to stdout or stderr.
+ *
+ * Stability: the functions and structs below are frozen for
+ * CRYPTY_ABI_VERSION 1. Later versions only add functions.
+ */
+
+#ifndef CRYPTY_H
+#define CRYPTY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define CRYPTY_API __attribute__((visibility("default")))
+#else
+#define CRYPTY_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CRYPTY_ABI_VERSION 1
+
+typedef struct crypty_engine crypty_engine;
+
+/* Verdicts. Only ELF data (0x7F 'E' 'L' 'F') is searched; anything else
+ * is clean. */
+enum {
+    CRYPTY_CLEAN = 0,
+    CRYPTY_INFECTED = 1,
+    CRYPTY_INCOMPLETE = 2,      /* cancelled by crypty_engine_destroy */
+    CRYPTY_ERROR = -1           /* could not be opened or read; see error */
+};
+
+typedef struct crypty_result {
+    int status;                 /* one of the verdicts above */
+    int error;                  /* errno of a CRYPTY_ERROR, else 0 */
+    int64_t offset;             /* first match if infected, else -1 */
+    int elf_class;              /* 32 or 64, 0 if unknown, -1 if not ELF */
+    uint64_t bytes_read;
+} crypty_result;
+
+/* Receives the result of a submitted scan. `name` is the submitted path,
+ * or "fd" for crypty_submit_fd; both pointers are valid during the call
+ * only. */
+typedef void (*crypty_callback)(void* user, const char* name, const crypty_result* result);
+
+/* CRYPTY_ABI_VERSION of the loaded library. */
+CRYPTY_API int crypty_abi_version(void);
+
+/* Create an engine with a copy of the signature and `threads` pool
+ * threads (0: one per core). Return 0, or EINVAL (empty signature),
+ * ENOMEM or EAGAIN (threads could not be started). */
+CRYPTY_API int crypty_engine_create(const void* signature, size_t size, unsigned threads,
+                                    crypty_engine** engine);
+
+/* The same with the signature read from a file. Returns 0 or an errno. */
+CRYPTY_API int crypty_engine_create_from_file(const char* signature_path, unsigned threads,
+                                              crypty_engine** engine);
+
+/* Cancel submitted scans that have not finished (their callbacks still run,
+ * with CRYPTY_INCOMPLETE), wait for all callbacks, then free the engine. */
+CRYPTY_API void crypty_engine_destroy(crypty_engine* engine);
+
+/* Scan on the calling thread. Return the verdict, also stored in `result`
+ * when not NULL. scan_fd reads with pread: the descriptor's offset is left
+ * alone and it stays open. */
+CRYPTY_API int crypty_scan_path(crypty_engine* engine, const char* path, crypty_result* result);
+CRYPTY_API int crypty_scan_fd(crypty_engine* engine, int fd, crypty_result* result);
+CRYPTY_API int crypty_scan_buffer(crypty_engine* engine, const void* data, size_t size,
+                                  crypty_result* result);
+
+/* Queue a scan on the pool; `callback` is called exactly once when it is
+ * done. The path is copied; the descriptor must stay open until the
+ * callback. Return 0, or EINVAL or ENOMEM (the callback is not called). */
+CRYPTY_API int crypty_submit_path(crypty_engine* engine, const char* path,
+                                  crypty_callback callback, void* user);
+CRYPTY_API int crypty_submit_fd(crypty_engine* engine, int fd, crypty_callback callback,
+                                void* user);
+
+/* Block until every scan submitted so far has called its callback. */
+CRYPTY_API void crypty_wait(crypty_engine* engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CRYPTY_H */
@@ -0,0 +1,201 @@
+// ======== crypty-scan: shell client for the scanner daemon ========
+// Sends scan requests to `find_sig.exe --daemon <socket>` and prints its
+// verdicts, one line per file. All requests are sent up front (pipelined)
+// while replies are read as they arrive, so the daemon's per-connection
+// limit, not this client, decides how many files are scanned at once.
+//
+// Build: g++ -std=c++17 -O2 -o crypty-scan crypty_scan.cpp
+// Usage: ./crypty-scan [--socket <path>] [--fd] <path>...
+//        ./crypty-scan [--socket <path>] -          (scan standard input)
+//
+// --fd opens each file here and passes the descriptor (SCM_RIGHTS), for
+// files the daemon itself may not read. A file is opened just before its
+// request is sent and closed once it is, so only one is open at a time.
+// Exit status: 0 if everything was clean, 2 if anything was infected, 1 on
+// errors.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <filesystem>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace fs = std::filesystem;
+
+const char* const DEFAULT_SOCKET = "/tmp/crypty.sock";
+
+// ------------------------- Requests -------------------------
+
+// One request as it goes on the wire; `fd` travels with its first byte.
+// With --fd, `open` names the file to open for `fd` when it is sent.
+struct Message {
+    std::string data;
+    std::string open;
+    int fd = -1;
+    size_t sent = 0;
+};
+
+bool readAll(int fd, std::string& out) {
+    char buffer[64 << 10];
+    while (true) {
+        ssize_t n = ::read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        if (n == 0) return true;
+        out.append(buffer, static_cast<size_t>(n));
+    }
+}
+
+// Sends what the socket takes without blocking; false if it failed.
+bool sendSome(int sock, Message& m) {
+    struct iovec iov = {&m.data[m.sent], m.data.size() - m.sent};
+    struct msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    if (m.fd >= 0 && m.sent == 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(c), &m.fd, sizeof(int));
+    }
+    ssize_t n = ::sendmsg(sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) return errno == EAGAIN || errno == EINTR;
+    m.sent += static_cast<size_t>(n);
+    return true;
+}
+
+// ------------------------- Main -------------------------
+
+int main(int argc, char* argv[]) {
+    const char* env = std::getenv("CRYPTY_SOCKET");
+    std::string socketPath = env ? env : DEFAULT_SOCKET;
+    bool passFd = false;
+    std::vector<std::string> targets;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (arg == "--fd") {
+            passFd = true;
+        } else if (arg == "-" || arg.compare(0, 2, "--") != 0) {
+            targets.push_back(arg);
+        } else {
+            targets.clear();
+            break;
+        }
+    }
+    if (targets.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--socket <path>] [--fd] <path>...\n"
+                  << "       " << argv[0] << " [--socket <path>] -    (scan standard input)\n"
+                  << "  default socket: $CRYPTY_SOCKET or " << DEFAULT_SOCKET << "\n";
+        return 1;
+    }
+
+    bool failed = false;
+    std::deque<Message> outgoing;
+    for (const auto& target : targets) {
+        Message m;
+        if (target == "-") {
+            std::string data;
+            if (!readAll(STDIN_FILENO, data)) {
+                std::cerr << "Error: Cannot read standard input: " << std::strerror(errno) << "\n";
+                return 1;
+            }
+            m.data = "STREAM " + std::to_string(data.size()) + "\n" + data;
+        } else if (passFd) {
+            m.open = target;
+            m.data = "SCAN-FD\n";
+        } else {
+            m.data = "SCAN " + fs::absolute(target).lexically_normal().string() + "\n";
+        }
+        outgoing.push_back(std::move(m));
+    }
+    size_t expected = outgoing.size();
+
+    int sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    if (sock < 0 || ::connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "Error: Cannot connect to " << socketPath << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+
+    // Replies are "<n> <verdict line>" and "<n> END <files> <infected> <errors>".
+    size_t ended = 0;
+    bool infected = false;
+    std::string input;
+    while (ended < expected) {
+        struct pollfd pfd = {sock, POLLIN, 0};
+        if (!outgoing.empty()) pfd.events |= POLLOUT;
+        if (::poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if ((pfd.revents & POLLOUT) && !outgoing.empty()) {
+            Message& m = outgoing.front();
+            if (!m.open.empty() && m.fd < 0) {
+                m.fd = ::open(m.open.c_str(), O_RDONLY | O_CLOEXEC);
+                if (m.fd < 0) {
+                    std::cout << fs::path(m.open) << ": ERROR " << std::strerror(errno) << "\n";
+                    failed = true;
+                    --expected;
+                    outgoing.pop_front();
+                    continue;
+                }
+            }
+            if (!sendSome(sock, m)) {
+                std::cerr << "Error: Lost connection to " << socketPath << ": " << std::strerror(errno) << "\n";
+                return 1;
+            }
+            if (m.sent == m.data.size()) {
+                if (m.fd >= 0) ::close(m.fd);
+                outgoing.pop_front();
+            }
+        }
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            char buffer[16 << 10];
+            ssize_t n = ::recv(sock, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            input.append(buffer, static_cast<size_t>(n));
+            size_t start = 0, end;
+            while ((end = input.find('\n', start)) != std::string::npos) {
+                std::string line = input.substr(start, end - start);
+                start = end + 1;
+                size_t space = line.find(' ');
+                std::string rest = space == std::string::npos ? line : line.substr(space + 1);
+                if (rest.compare(0, 4, "END ") == 0) {
+                    std::istringstream counts(rest.substr(4));
+                    uint64_t files = 0, hits = 0, errors = 0;
+                    counts >> files >> hits >> errors;
+                    infected = infected || hits > 0;
+                    failed = failed || errors > 0;
+                    ++ended;
+                } else {
+                    std::cout << rest << "\n";
+                }
+            }
+            input.erase(0, start);
+        }
+    }
+    ::close(sock);
+    if (ended < expected) {
+        std::cerr << "Error: The daemon closed the connection early.\n";
+        return 1;
+    }
+    return infected ? 2 : failed ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+// ======== Crypty Live Stats Layout ========
+// Shared between find_sig (--stats-shm) and crypty-top. The scanner maps a
+// POSIX shared-memory segment holding one StatsBlock and updates it with
+// plain stores; readers attach read-only and copy it out under seqlocks.
+//
+// Seqlock protocol: a writer makes `seq` odd, writes, then makes it even
+// again. A reader copies the data between two loads of `seq` and retries if
+// they differ or are odd. Each worker slot has its own writer (the worker
+// thread) and its own seq; the header fields are written by the scanner's
+// main thread only.
+
+#ifndef CRYPTY_STATS_H
+#define CRYPTY_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace crypty_stats {
+
+constexpr uint32_t MAGIC = 0x43525953;      // "CRYS"
+constexpr uint32_t VERSION = 1;
+constexpr uint32_t MAX_WORKERS = 256;
+constexpr size_t PATH_SIZE = 256;           // current file, truncated from the left
+
+// What a worker is doing; matches the scanner's phases.
+enum WorkerState : uint32_t { IDLE, WALK, OPEN, MAGIC_CHECK, READ, MATCH, REPORT };
+
+inline const char* stateName(uint32_t state) {
+    static const char* names[] = {"idle", "walk", "open", "magic", "read", "match", "report"};
+    return state <= REPORT ? names[state] : "?";
+}
+
+struct Worker {
+    uint32_t state;
+    uint32_t pad;
+    uint64_t filesDone;
+    uint64_t bytesRead;
+    uint64_t hits;
+    char file[PATH_SIZE];
+};
+
+struct Totals {
+    uint64_t startedUnixMs;
+    uint64_t updatedUnixMs;
+    uint64_t filesQueued, bytesQueued;      // found by the walk so far
+    uint64_t filesDone, bytesDone;
+    uint64_t bytesPerSec;                   // over the last update interval
+    uint64_t pending, running;              // scan tasks queued / executing
+    uint64_t stageDepth[4];                 // --pipeline: open, read, match, report
+    uint32_t pipeline;                      // stageDepth is valid
+    uint32_t finished;                      // scan over; the segment is about to go
+};
+
+struct alignas(64) WorkerSlot {
+    std::atomic<uint32_t> seq;
+    Worker data;
+};
+
+struct StatsBlock {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pid;
+    std::atomic<uint32_t> workers;          // slots handed out
+    alignas(64) std::atomic<uint32_t> seq;
+    Totals totals;
+    WorkerSlot worker[MAX_WORKERS];
+};
+
+// Writer side: `update` runs between the two seq stores. One writer per
+// seq only.
+template <typename Data, typename Update>
+inline void seqWrite(std::atomic<uint32_t>& seq, Data& data, Update&& update) {
+    uint32_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    update(data);
+    seq.store(s + 2, std::memory_order_release);
+}
+
+// Reader side: false if the writer kept it busy for `attempts` tries.
+template <typename Data>
+inline bool seqRead(const std::atomic<uint32_t>& seq, const Data& data, Data& out,
+                    int attempts = 100) {
+    for (int i = 0; i < attempts; ++i) {
+        uint32_t before = seq.load(std::memory_order_acquire);
+        if (before & 1) continue;
+        std::memcpy(static_cast<void*>(&out), static_cast<const void*>(&data), sizeof(Data));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq.load(std::memory_order_relaxed) == before) return true;
+    }
+    return false;
+}
+
+}  // namespace crypty_stats
+
+#endif  // CRYPTY_STATS_H
@@ -0,0 +1,180 @@
+// ======== crypty-top: live view of a running scan ========
+// Attaches read-only to the shared-memory stats block that
+// `find_sig.exe --stats-shm <name>` publishes and redraws it every second:
+// totals, throughput, ETA, queue depths and what each worker is doing.
+// The scanner is never slowed down or blocked by a viewer; a snapshot
+// torn by a concurrent update is simply read again.
+//
+// Build: g++ -std=c++17 -O2 -o crypty-top crypty_top.cpp
+// Usage: ./crypty-top [--once] [--interval-ms <n>] <name>
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "crypty_stats.h"
+
+namespace cs = crypty_stats;
+
+// ------------------------- Formatting -------------------------
+
+std::string humanBytes(double bytes) {
+    static const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4) {
+        bytes /= 1024;
+        ++unit;
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(unit ? 1 : 0) << bytes << " " << units[unit];
+    return out.str();
+}
+
+std::string humanSeconds(double secs) {
+    std::ostringstream out;
+    long s = static_cast<long>(secs);
+    if (s >= 3600) out << s / 3600 << "h";
+    if (s >= 60) out << (s % 3600) / 60 << "m";
+    out << s % 60 << "s";
+    return out.str();
+}
+
+// ------------------------- Snapshot -------------------------
+
+struct Snapshot {
+    cs::Totals totals;
+    uint32_t workers = 0;
+    cs::Worker worker[cs::MAX_WORKERS];
+    bool torn = false;          // some slot stayed busy for every attempt
+};
+
+void takeSnapshot(const cs::StatsBlock& block, Snapshot& snap) {
+    snap.torn = !cs::seqRead(block.seq, block.totals, snap.totals);
+    snap.workers = std::min(block.workers.load(std::memory_order_acquire), cs::MAX_WORKERS);
+    for (uint32_t i = 0; i < snap.workers; ++i)
+        if (!cs::seqRead(block.worker[i].seq, block.worker[i].data, snap.worker[i])) snap.torn = true;
+}
+
+void render(const cs::StatsBlock& block, const Snapshot& snap, bool clear) {
+    const cs::Totals& t = snap.totals;
+    const uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    const double elapsed = t.startedUnixMs && now > t.startedUnixMs ? (now - t.startedUnixMs) / 1e3 : 0;
+    const double eta = t.bytesPerSec && t.bytesQueued > t.bytesDone
+                           ? double(t.bytesQueued - t.bytesDone) / t.bytesPerSec : 0;
+
+    uint64_t hits = 0;
+    for (uint32_t i = 0; i < snap.workers; ++i) hits += snap.worker[i].hits;
+
+    std::ostringstream out;
+    if (clear) out << "\033[H\033[2J";
+    out << "crypty scan, pid " << block.pid << (t.finished ? " (finished)" : "") << ", running "
+        << humanSeconds(elapsed) << (snap.torn ? "  [busy, partial update]" : "") << "\n"
+        << "Files  " << t.filesDone << " / " << t.filesQueued << "   Bytes  " << humanBytes(t.bytesDone)
+        << " / " << humanBytes(t.bytesQueued) << "   " << humanBytes(t.bytesPerSec) << "/s";
+    if (!t.finished && eta > 0) out << "   ETA " << humanSeconds(eta);
+    out << "\nInfected " << hits << "   Tasks " << t.pending << " pending, " << t.running << " running";
+    if (t.pipeline) {
+        static const char* stages[] = {"open", "read", "match", "report"};
+        out << "   Queues";
+        for (int s = 0; s < 4; ++s) out << " " << stages[s] << " " << t.stageDepth[s];
+    }
+    out << "\n\n" << std::left << std::setw(4) << "#" << std::setw(8) << "state" << std::right
+        << std::setw(10) << "files" << std::setw(12) << "read" << std::setw(6) << "hits" << "  file\n";
+    for (uint32_t i = 0; i < snap.workers; ++i) {
+        const cs::Worker& w = snap.worker[i];
+        out << std::left << std::setw(4) << i << std::setw(8) << cs::stateName(w.state) << std::right
+            << std::setw(10) << w.filesDone << std::setw(12) << humanBytes(double(w.bytesRead))
+            << std::setw(6) << w.hits << "  " << w.file << "\n";
+    }
+    std::cout << out.str() << std::flush;
+}
+
+// The scanner writes magic and version once, after a release fence, while
+// this process may already be polling them.
+uint32_t loadHeader(const uint32_t& field) {
+    uint32_t value = *static_cast<const volatile uint32_t*>(&field);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return value;
+}
+
+// ------------------------- Main -------------------------
+
+int main(int argc, char* argv[]) {
+    bool once = false;
+    long intervalMs = 1000;
+    std::string name;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--once") {
+            once = true;
+        } else if (arg == "--interval-ms" && i + 1 < argc) {
+            try {
+                intervalMs = std::max(50L, std::stol(argv[++i]));
+            } catch (const std::exception&) {
+                std::cerr << "Invalid numeric option value.\n";
+                name.clear();
+                break;
+            }
+        } else if (name.empty() && arg.compare(0, 2, "--") != 0) {
+            name = arg;
+        } else {
+            name.clear();
+            break;
+        }
+    }
+    if (name.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--once] [--interval-ms <n>] <name>\n"
+                  << "  <name> as given to find_sig.exe --stats-shm, e.g. /crypty\n";
+        return 1;
+    }
+
+    int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        std::cerr << "Error: Cannot open shared memory " << name << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(cs::StatsBlock)) {
+        std::cerr << "Error: " << name << " is not a crypty stats block\n";
+        ::close(fd);
+        return 1;
+    }
+    void* map = ::mmap(nullptr, sizeof(cs::StatsBlock), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "Error: Cannot map " << name << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    const auto& block = *static_cast<const cs::StatsBlock*>(map);
+    // The scanner may still be initializing the block.
+    for (int i = 0; loadHeader(block.magic) != cs::MAGIC && i < 50; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const uint32_t version = loadHeader(block.version);
+    if (loadHeader(block.magic) != cs::MAGIC || version != cs::VERSION) {
+        std::cerr << "Error: " << name << " is not a crypty stats block (version "
+                  << version << ")\n";
+        ::munmap(map, sizeof(cs::StatsBlock));
+        return 1;
+    }
+
+    // Large enough (~100 KiB) to keep off the stack.
+    static Snapshot snap;
+    while (true) {
+        takeSnapshot(block, snap);
+        render(block, snap, !once && isatty(STDOUT_FILENO));
+        if (once || snap.totals.finished) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+    }
+    ::munmap(map, sizeof(cs::StatsBlock));
+    return 0;
+}
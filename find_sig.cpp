@@ -16,6 +16,15 @@
  * - Scans files using a sliding buffer window to catch cross-boundary matches
  * - Uses a thread pool for parallelism (one thread per core)
  * - Reports infected files, and handles errors per file without crashing
+ * - Optionally records per-directory summaries (--state) so that unchanged
+ *   subtrees are skipped on the next run
+ * - Optionally runs as an on-access daemon (--on-access, Linux fanotify)
+ * - Optionally keeps watching the tree and rescans changed files (--watch, inotify)
+ * - Optionally scans a list of paths from stdin or a manifest instead of walking
+ * - Optionally pins workers per NUMA node and keeps their buffers node-local (--numa)
+ * - Optionally scans with C++20 coroutines over offloaded I/O (--coroutines)
+ * - Optionally serves scan requests on a Unix socket (--daemon)
+ * - Builds as libcrypty.so for in-process use through a C ABI (crypty.h)
  *
  * Assumptions:
  * - Input signature file can be read fully into memory.
@@ -24,6 +33,9 @@
  *
  * Compilation:
  *    g++ -std=c++17 -pthread -O2 -o find_sig.exe find_sig.cpp
+ *    (-std=c++20 additionally enables the coroutine core)
+ *    g++ -std=c++17 -pthread -O2 -fPIC -shared -fvisibility=hidden -DCRYPTY_LIBRARY \
+ *        -o libcrypty.so find_sig.cpp
  */
 
 #include <iostream>
@@ -40,151 +52,5444 @@
 #include <functional>
 #include <atomic>
 #include <future>
+#include <map>
+#include <set>
+#include <sstream>
+#include <chrono>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <type_traits>
+#include <new>
+#include <cstddef>
+#include <charconv>
+#include <tuple>
+#include <system_error>
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define CRYPTY_COROUTINES 1
+#endif
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/sysmacros.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "crypty_stats.h"
+#include "crypty.h"
 
 namespace fs = std::filesystem;
 
 constexpr size_t MIN_BUFFER_SIZE = 4096;
 constexpr size_t EXTRA_BUFFER = 1024;
 
+// ------------------------- Work-Stealing Deque -------------------------
+//
+// Chase-Lev deque (Le, Pop, Cohen, Zappa Nardelli, PPoPP'13): the owning
+// worker pushes and pops at the bottom without locks, thieves take from the
+// top with a single CAS. Arrays replaced while growing are kept until the
+// deque dies because a thief may still be reading from them.
+
+template <typename T>
+class WorkStealingDeque {
+    static_assert(std::is_pointer<T>::value, "WorkStealingDeque holds raw pointers");
+
+public:
+    explicit WorkStealingDeque(int64_t capacity = 256)
+        : array(new Array(capacity)) {}
+
+    ~WorkStealingDeque() {
+        delete array.load(std::memory_order_relaxed);
+    }
+
+    // Owner only.
+    void push(T item) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array* a = array.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1) a = grow(a, t, b);
+
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only; nullptr when empty.
+    T pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        T item = nullptr;
+        if (t <= b) {
+            item = a->get(b);
+            if (t == b) {
+                // Last element: race against thieves for it.
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                 std::memory_order_relaxed))
+                    item = nullptr;
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread; nullptr when empty or when another thief won the race.
+    T steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+
+        Array* a = array.load(std::memory_order_acquire);
+        T item = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+            return nullptr;
+        return item;
+    }
+
+    bool empty() const {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Array {
+        int64_t capacity;
+        std::unique_ptr<std::atomic<T>[]> slots;
+
+        explicit Array(int64_t cap) : capacity(cap), slots(new std::atomic<T>[cap]) {}
+        T get(int64_t i) const { return slots[i & (capacity - 1)].load(std::memory_order_relaxed); }
+        void put(int64_t i, T v) { slots[i & (capacity - 1)].store(v, std::memory_order_relaxed); }
+    };
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<Array*> array;
+    std::vector<std::unique_ptr<Array>> retired;
+
+    Array* grow(Array* old, int64_t t, int64_t b) {
+        Array* bigger = new Array(old->capacity * 2);
+        for (int64_t i = t; i < b; ++i) bigger->put(i, old->get(i));
+        retired.emplace_back(old);
+        array.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+};
+
+// ------------------------- Task -------------------------
+//
+// Move-only callable stored inline: no heap allocation on construction or
+// move. A callable larger than INLINE_CAPACITY is a compile-time error;
+// capture big state by pointer or shared_ptr instead.
+
+class Task {
+public:
+    static constexpr size_t INLINE_CAPACITY = 128;
+
+    Task() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, Task>::value>>
+    Task(F&& f) {
+        using Fn = std::decay_t<F>;
+        static_assert(sizeof(Fn) <= INLINE_CAPACITY, "callable exceeds Task::INLINE_CAPACITY");
+        static_assert(alignof(Fn) <= alignof(std::max_align_t), "callable is over-aligned");
+        static_assert(std::is_nothrow_move_constructible<Fn>::value, "callable must be nothrow-movable");
+        new (storage) Fn(std::forward<F>(f));
+        ops = &opsFor<Fn>;
+    }
+
+    Task(Task&& other) noexcept { moveFrom(other); }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    explicit operator bool() const { return ops != nullptr; }
+    void operator()() { ops->invoke(storage); }
+
+    void reset() {
+        if (ops) ops->destroy(storage);
+        ops = nullptr;
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void*);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void*);
+    };
+
+    template <typename Fn>
+    static constexpr Ops opsFor = {
+        [](void* p) { (*static_cast<Fn*>(p))(); },
+        [](void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        },
+        [](void* p) { static_cast<Fn*>(p)->~Fn(); },
+    };
+
+    alignas(std::max_align_t) unsigned char storage[INLINE_CAPACITY];
+    const Ops* ops = nullptr;
+
+    void moveFrom(Task& other) noexcept {
+        if (other.ops) other.ops->move(storage, other.storage);
+        ops = other.ops;
+        other.ops = nullptr;
+    }
+};
+
+// ------------------------- MPMC Ring -------------------------
+//
+// Bounded multi-producer/multi-consumer queue (Vyukov): each cell carries a
+// sequence number telling producers and consumers whose turn it is, so push
+// and pop are one CAS on a shared index plus a release store, with no locks
+// and no allocation after construction.
+
+template <typename T>
+class MpmcRing {
+public:
+    explicit MpmcRing(size_t capacity) : mask(capacity - 1), cells(new Cell[capacity]) {
+        if (capacity < 2 || (capacity & mask) != 0)
+            throw std::invalid_argument("MpmcRing capacity must be a power of two");
+        for (size_t i = 0; i < capacity; ++i)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    ~MpmcRing() {
+        T item;
+        while (tryPop(item)) {}
+    }
+
+    // Moves from `item` only on success; false when the ring is full.
+    bool tryPush(T& item) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (dif == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        new (cell->storage) T(std::move(item));
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // False when the ring is empty.
+    bool tryPop(T& out) {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (dif == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        T* item = reinterpret_cast<T*>(cell->storage);
+        out = std::move(*item);
+        item->~T();
+        cell->seq.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate; exact when no push or pop is in progress.
+    size_t size() const {
+        size_t head = dequeuePos.load(std::memory_order_seq_cst);
+        size_t tail = enqueuePos.load(std::memory_order_seq_cst);
+        return tail > head ? tail - head : 0;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    const size_t mask;
+    std::unique_ptr<Cell[]> cells;
+    alignas(64) std::atomic<size_t> enqueuePos{0};
+    alignas(64) std::atomic<size_t> dequeuePos{0};
+};
+
+// ------------------------- Task Group -------------------------
+//
+// Completion barrier and progress counters for a set of pool tasks. The pool
+// maintains pending/running; the tasks themselves report files and bytes
+// done. wait() blocks until every task submitted to the group (including
+// tasks submitted by those tasks) has finished, optionally calling a progress
+// callback at a fixed interval, so a caller can wait without destroying the
+// pool.
+
+class TaskGroup {
+public:
+    struct Progress {
+        uint64_t pending;       // submitted, not yet finished
+        uint64_t running;       // currently executing
+        uint64_t filesDone;
+        uint64_t bytesDone;
+    };
+
+    TaskGroup() = default;
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void addFile(uint64_t bytes) {
+        bytesDone.fetch_add(bytes, std::memory_order_relaxed);
+        filesDone.fetch_add(1, std::memory_order_seq_cst);
+        if (fileWaiters.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            fileDone.notify_all();
+        }
+    }
+    void addBytes(uint64_t bytes) { bytesDone.fetch_add(bytes, std::memory_order_relaxed); }
+
+    Progress progress() const {
+        return {pending.load(), running.load(), filesDone.load(), bytesDone.load()};
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return pending.load() == 0; });
+    }
+
+    // Waits until at least `files` files are done or the timeout expires.
+    bool waitForFiles(uint64_t files, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        fileWaiters.fetch_add(1, std::memory_order_seq_cst);
+        bool reached = fileDone.wait_for(lock, timeout, [&]() {
+            return filesDone.load(std::memory_order_seq_cst) >= files;
+        });
+        fileWaiters.fetch_sub(1, std::memory_order_relaxed);
+        return reached;
+    }
+
+    template <typename Callback>
+    void wait(Callback&& onProgress, std::chrono::milliseconds interval) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!done.wait_for(lock, interval, [this]() { return pending.load() == 0; })) {
+            lock.unlock();
+            onProgress(progress());
+            lock.lock();
+        }
+    }
+
+private:
+    friend class ThreadPool;
+
+    std::atomic<uint64_t> pending{0};
+    std::atomic<uint64_t> running{0};
+    std::atomic<uint64_t> filesDone{0};
+    std::atomic<uint64_t> bytesDone{0};
+
+    // `pending` only drops to zero under the mutex, and that finisher notifies
+    // before releasing it, so a waiter that sees zero can destroy the group
+    // safely. A task submitted meanwhile simply keeps the waiter waiting.
+    std::mutex mutex;
+    std::condition_variable done;
+    std::condition_variable fileDone;           // for waitForFiles()
+    std::atomic<size_t> fileWaiters{0};
+
+    void submitted() { pending.fetch_add(1); }
+    void started() { running.fetch_add(1, std::memory_order_relaxed); }
+    void finished() {
+        running.fetch_sub(1, std::memory_order_relaxed);
+        uint64_t count = pending.load();
+        while (count > 1)
+            if (pending.compare_exchange_weak(count, count - 1)) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending.fetch_sub(1) == 1) done.notify_all();
+    }
+};
+
+// ------------------------- NUMA Topology -------------------------
+//
+// Read from sysfs instead of libnuma so the build needs no extra library. On
+// a single-node machine, or off Linux, there is one node and the pool below
+// behaves exactly as without --numa.
+
+// Parses a sysfs CPU list such as "0-3,8-11".
+std::vector<int> parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream in(list);
+    std::string part;
+    while (std::getline(in, part, ',')) {
+        size_t dash = part.find('-');
+        try {
+            int lo = std::stoi(part.substr(0, dash));
+            int hi = dash == std::string::npos ? lo : std::stoi(part.substr(dash + 1));
+            for (int cpu = lo; cpu <= hi; ++cpu) cpus.push_back(cpu);
+        } catch (const std::exception&) {
+            // Malformed entry: ignore it.
+        }
+    }
+    return cpus;
+}
+
+struct NumaTopology {
+    std::vector<int> ids;                       // sysfs node ids, ascending
+    std::vector<std::vector<int>> nodeCpus;     // CPUs of each node, same order
+
+    size_t nodes() const { return std::max<size_t>(1, nodeCpus.size()); }
+
+    // Dense node index for a sysfs node id, or -1.
+    int indexOf(int id) const {
+        auto it = std::find(ids.begin(), ids.end(), id);
+        return it == ids.end() ? -1 : static_cast<int>(it - ids.begin());
+    }
+
+    // Node of the storage controller behind a block device, or -1 if unknown.
+    int storageNode(dev_t dev) const;
+
+    static NumaTopology detect();
+};
+
+NumaTopology NumaTopology::detect() {
+    NumaTopology topology;
+#ifdef __linux__
+    std::map<int, std::vector<int>> found;
+    std::error_code ec;
+    for (fs::directory_iterator it("/sys/devices/system/node", ec), end; !ec && it != end;
+         it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (name.size() <= 4 || name.compare(0, 4, "node") != 0 ||
+            name.find_first_not_of("0123456789", 4) != std::string::npos)
+            continue;
+        std::ifstream in(it->path() / "cpulist");
+        std::string list;
+        std::getline(in, list);
+        std::vector<int> cpus = parseCpuList(list);
+        // Memory-only nodes have no CPUs to run workers on.
+        if (!cpus.empty()) found[std::stoi(name.substr(4))] = std::move(cpus);
+    }
+    for (auto& node : found) {
+        topology.ids.push_back(node.first);
+        topology.nodeCpus.push_back(std::move(node.second));
+    }
+#endif
+    return topology;
+}
+
+int NumaTopology::storageNode(dev_t dev) const {
+#ifdef __linux__
+    // The block device itself has no numa_node; its controller (usually a PCI
+    // function) somewhere up the device path does.
+    std::error_code ec;
+    fs::path dir = fs::canonical("/sys/dev/block/" + std::to_string(major(dev)) + ":" +
+                                 std::to_string(minor(dev)), ec);
+    for (; !ec && dir.has_relative_path(); dir = dir.parent_path()) {
+        std::ifstream in(dir / "numa_node");
+        int id;
+        if (in >> id) return id < 0 ? -1 : indexOf(id);
+    }
+#else
+    (void)dev;
+#endif
+    return -1;
+}
+
 // ------------------------- Thread Pool -------------------------
-class ThreadPool {
+//
+// Every worker owns a WorkStealingDeque. Tasks submitted from a worker go to
+// its own deque; tasks from other threads (the walker, the daemons) go to a
+// bounded lock-free injection ring that workers drain in batches into their
+// deques. When the ring is full the submitter sleeps until workers have
+// drained it to half; trySubmit() refuses the task instead.
+//
+// Deques hold TaskNode pointers. Nodes come from a per-worker free list and
+// are returned to their owner after running (directly, or through a
+// lock-free stack when another worker ran them), so after warm-up neither
+// submission nor dequeue allocates.
+//
+// Work is split into three priority lanes, each with its own deques and
+// injection ring. Workers look at the interactive lane first, but every 4th
+// pick starts at the normal lane and every 16th at the background lane, so
+// lower lanes keep making progress under a steady interactive load. A
+// running background task can call yieldFor() between chunks to run waiting
+// higher-priority tasks inline.
+//
+// Idle workers steal from randomly chosen victims, then park on their own
+// condition variable. A submit wakes at most one parked worker, and a worker
+// that finds more work than it can start wakes the next one, so wake-ups
+// spread as a chain instead of a thundering herd.
+//
+// Given a NumaTopology, workers are spread over the nodes in proportion to
+// their CPUs and pinned to their node's CPU set, and every node gets its own
+// injection rings. A submit can name the node that should run the task (the
+// one its storage controller hangs off); an idle worker looks at its own
+// deque, its node's ring, then steals from workers on its node before it
+// touches other nodes' rings and, last, remote deques.
+
+enum class Priority { Interactive = 0, Normal = 1, Background = 2 };
+
+// Where a piece of work runs. The coroutine core resumes its scans through
+// this, so they run on the thread pool or on any other executor alike.
+class Executor {
+public:
+    virtual ~Executor() = default;
+    virtual void post(Task task, TaskGroup* group) = 0;
+};
+
+class ThreadPool : public Executor {
+public:
+    // Gets what an exception escaping a task said; on a worker thread.
+    using FailureHandler = std::function<void(const char* what)>;
+
+    // With `numa`, workers are pinned per node (see above). Without
+    // `onFailure`, task failures are printed on stderr.
+    explicit ThreadPool(size_t threadCount, const NumaTopology* numa = nullptr,
+                        FailureHandler onFailure = nullptr);
+    ~ThreadPool();
+
+    // `group`, if given, must outlive the task. `node` is a placement hint
+    // for tasks submitted from outside the pool; -1 spreads them evenly.
+    // From outside the pool a full injection ring blocks the caller until a
+    // worker drains it.
+    void submit(Task task, TaskGroup* group = nullptr, Priority priority = Priority::Normal,
+                int node = -1);
+    // Never blocks: false, with the task dropped, when the ring is full.
+    // For callers that must keep serving events, like the on-access loop.
+    bool trySubmit(Task task, Priority priority = Priority::Normal, int node = -1);
+    void post(Task task, TaskGroup* group) override { submit(std::move(task), group); }
+
+    // Runs f on the pool; exceptions are delivered through the future.
+    template <typename F>
+    auto async(F&& f, TaskGroup* group = nullptr, Priority priority = Priority::Normal)
+        -> std::future<std::invoke_result_t<std::decay_t<F>>>;
+
+    // Called from inside a task of priority `current`: runs up to a few
+    // waiting tasks of higher priority inline, then returns. No-op outside
+    // this pool's workers.
+    void yieldFor(Priority current);
+
+    // Tasks that ended with an exception (reported as they happen).
+    uint64_t failures() const { return failed.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t LANES = 3;
+
+    struct QueuedTask {
+        Task task;
+        TaskGroup* group = nullptr;
+    };
+
+    struct TaskNode {
+        Task task;
+        TaskGroup* group = nullptr;
+        size_t lane = 0;
+        size_t owner = 0;
+        TaskNode* next = nullptr;
+    };
+
+    struct Worker {
+        WorkStealingDeque<TaskNode*> deques[LANES];
+        std::mutex parkMutex;
+        std::condition_variable parked;
+        bool wake = false;
+        uint64_t rng = 0;
+        uint64_t picks = 0;
+        size_t node = 0;
+
+        std::vector<TaskNode*> freeNodes;               // owner only
+        std::atomic<TaskNode*> remoteFree{nullptr};     // pushed by other workers
+        std::vector<std::unique_ptr<TaskNode[]>> slabs;
+    };
+
+    static constexpr size_t INJECT_BATCH = 32;
+    static constexpr size_t INJECT_CAPACITY = 1 << 13;     // per lane
+    static constexpr size_t YIELD_BUDGET = 4;
+    static constexpr size_t NODE_SLAB = 256;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    size_t nodeCount = 1;
+    std::vector<std::vector<size_t>> nodeWorkers;   // worker indices per node
+    std::vector<std::vector<int>> pinCpus;          // per node; empty = no pinning
+
+    // Injection rings, indexed node * LANES + lane.
+    std::vector<std::unique_ptr<MpmcRing<QueuedTask>>> injected;
+    std::atomic<size_t> injectCursor{0};
+
+    // Submitters waiting for ring space; workers notify after taking tasks.
+    std::mutex roomMutex;
+    std::condition_variable roomFreed;
+    std::atomic<size_t> roomWaiters{0};
+
+    std::mutex idleMutex;
+    std::vector<size_t> idle;               // parked worker indices
+    std::atomic<size_t> idleCount{0};
+
+    std::atomic<bool> stop;
+    std::atomic<uint64_t> failed{0};
+    const FailureHandler onFailure;
+
+    static thread_local ThreadPool* currentPool;
+    static thread_local size_t currentIndex;
+
+    void workerThread(size_t index);
+    TaskNode* findWork(size_t index);
+    TaskNode* findInLane(size_t index, size_t lane);
+    TaskNode* stealInLane(size_t index, size_t lane, bool local);
+    TaskNode* takeInjected(size_t index, size_t lane, size_t node);
+    bool inject(QueuedTask& queued, size_t lane, int node, bool wait);
+    void pushLocal(Task task, TaskGroup* group, size_t lane);
+    MpmcRing<QueuedTask>& ring(size_t node, size_t lane) { return *injected[node * LANES + lane]; }
+    bool hasWork() const;
+    bool hasLaneWork(size_t lane) const;
+    bool park(size_t index);
+    void wakeOne(int node = -1);
+    TaskNode* allocNode(size_t index);
+    void freeNode(TaskNode* node);
+    void run(TaskNode* node);
+    void taskFailed(const char* what);
+};
+
+thread_local ThreadPool* ThreadPool::currentPool = nullptr;
+thread_local size_t ThreadPool::currentIndex = 0;
+
+ThreadPool::ThreadPool(size_t threadCount, const NumaTopology* numa, FailureHandler onFailure)
+    : stop(false), onFailure(std::move(onFailure)) {
+    size_t totalCpus = 0;
+    if (numa && !numa->nodeCpus.empty()) {
+        nodeCount = numa->nodeCpus.size();
+        pinCpus = numa->nodeCpus;
+        for (const auto& cpus : pinCpus) totalCpus += cpus.size();
+    }
+    nodeWorkers.resize(nodeCount);
+    for (size_t i = 0; i < nodeCount * LANES; ++i)
+        injected.emplace_back(new MpmcRing<QueuedTask>(INJECT_CAPACITY));
+
+    for (size_t i = 0; i < threadCount; ++i) {
+        workers.emplace_back(new Worker());
+        workers.back()->rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+
+        // Slot i % totalCpus falls into the node owning that CPU, so nodes
+        // get workers in proportion to their size.
+        size_t node = 0;
+        if (totalCpus > 0) {
+            for (size_t slot = i % totalCpus; slot >= pinCpus[node].size(); ++node)
+                slot -= pinCpus[node].size();
+        }
+        workers.back()->node = node;
+        nodeWorkers[node].push_back(i);
+    }
+    for (size_t i = 0; i < threadCount; ++i) {
+        threads.emplace_back([this, i]() { workerThread(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    stop = true;
+    for (auto& w : workers) {
+        std::lock_guard<std::mutex> lock(w->parkMutex);
+        w->wake = true;
+        w->parked.notify_one();
+    }
+    for (auto& t : threads)
+        if (t.joinable()) t.join();
+}
+
+template <typename F>
+auto ThreadPool::async(F&& f, TaskGroup* group, Priority priority)
+    -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+    using R = std::invoke_result_t<std::decay_t<F>>;
+    auto job = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+    std::future<R> result = job->get_future();
+    submit([job]() { (*job)(); }, group, priority);
+    return result;
+}
+
+void ThreadPool::submit(Task task, TaskGroup* group, Priority priority, int node) {
+    if (group) group->submitted();
+    const size_t lane = static_cast<size_t>(priority);
+
+    if (currentPool == this) {
+        pushLocal(std::move(task), group, lane);
+        return;
+    }
+    QueuedTask queued{std::move(task), group};
+    inject(queued, lane, node, true);
+}
+
+bool ThreadPool::trySubmit(Task task, Priority priority, int node) {
+    const size_t lane = static_cast<size_t>(priority);
+
+    if (currentPool == this) {
+        pushLocal(std::move(task), nullptr, lane);
+        return true;
+    }
+    QueuedTask queued{std::move(task), nullptr};
+    return inject(queued, lane, node, false);
+}
+
+// Worker deques grow as needed, so a task submitted by a task never waits.
+void ThreadPool::pushLocal(Task task, TaskGroup* group, size_t lane) {
+    TaskNode* taskNode = allocNode(currentIndex);
+    taskNode->task = std::move(task);
+    taskNode->group = group;
+    taskNode->lane = lane;
+    workers[currentIndex]->deques[lane].push(taskNode);
+    wakeOne(static_cast<int>(workers[currentIndex]->node));
+}
+
+// A full ring means the workers are behind: rather than spin, the submitter
+// sleeps until takeInjected makes room. The timed wait covers the rare case
+// where a worker reads roomWaiters just before it was raised.
+bool ThreadPool::inject(QueuedTask& queued, size_t lane, int node, bool wait) {
+    size_t target = node >= 0 && static_cast<size_t>(node) < nodeCount
+                        ? static_cast<size_t>(node)
+                        : injectCursor.fetch_add(1, std::memory_order_relaxed) % nodeCount;
+    MpmcRing<QueuedTask>& dest = ring(target, lane);
+    if (!dest.tryPush(queued)) {
+        if (!wait) {
+            wakeOne(static_cast<int>(target));
+            return false;
+        }
+        roomWaiters.fetch_add(1);
+        std::unique_lock<std::mutex> lock(roomMutex);
+        while (!dest.tryPush(queued)) {
+            wakeOne(static_cast<int>(target));
+            roomFreed.wait_for(lock, std::chrono::milliseconds(10));
+        }
+        roomWaiters.fetch_sub(1);
+    }
+    wakeOne(static_cast<int>(target));
+    return true;
+}
+
+ThreadPool::TaskNode* ThreadPool::allocNode(size_t index) {
+    Worker& w = *workers[index];
+    if (w.freeNodes.empty()) {
+        for (TaskNode* n = w.remoteFree.exchange(nullptr, std::memory_order_acquire); n;) {
+            TaskNode* next = n->next;
+            w.freeNodes.push_back(n);
+            n = next;
+        }
+    }
+    if (w.freeNodes.empty()) {
+        w.slabs.emplace_back(new TaskNode[NODE_SLAB]);
+        for (size_t i = 0; i < NODE_SLAB; ++i) {
+            w.slabs.back()[i].owner = index;
+            w.freeNodes.push_back(&w.slabs.back()[i]);
+        }
+    }
+    TaskNode* node = w.freeNodes.back();
+    w.freeNodes.pop_back();
+    return node;
+}
+
+void ThreadPool::freeNode(TaskNode* node) {
+    Worker& owner = *workers[node->owner];
+    if (currentPool == this && currentIndex == node->owner) {
+        owner.freeNodes.push_back(node);
+        return;
+    }
+    // Push-only Treiber stack; the owner takes the whole list at once, so
+    // there is no ABA problem.
+    TaskNode* head = owner.remoteFree.load(std::memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!owner.remoteFree.compare_exchange_weak(head, node, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+}
+
+void ThreadPool::run(TaskNode* node) {
+    TaskGroup* group = node->group;
+    if (group) group->started();
+    try {
+        node->task();
+    } catch (const std::exception& e) {
+        taskFailed(e.what());
+    } catch (...) {
+        taskFailed("unknown exception");
+    }
+    node->task.reset();
+    freeNode(node);
+    if (group) group->finished();
+}
+
+// Tasks are expected to catch their own errors; one that escapes is still
+// counted and reported instead of vanishing with the task.
+void ThreadPool::taskFailed(const char* what) {
+    failed.fetch_add(1, std::memory_order_relaxed);
+    if (onFailure) onFailure(what);
+    else std::cerr << std::string("Error: Task failed: ") + what + "\n";
+}
+
+void ThreadPool::workerThread(size_t index) {
+    currentPool = this;
+    currentIndex = index;
+
+#ifdef __linux__
+    // Pin before the worker allocates anything, so first touch puts its
+    // node slabs and scan buffers on its own node.
+    if (!pinCpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : pinCpus[workers[index]->node])
+            if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+
+    while (true) {
+        TaskNode* node = findWork(index);
+        if (node) {
+            run(node);
+            continue;
+        }
+        if (!park(index)) return;
+    }
+}
+
+ThreadPool::TaskNode* ThreadPool::findWork(size_t index) {
+    static constexpr size_t ORDERS[3][LANES] = {{0, 1, 2}, {1, 0, 2}, {2, 1, 0}};
+
+    // Starvation protection: every 16th pick favours background, every 4th
+    // normal; otherwise interactive first.
+    Worker& self = *workers[index];
+    ++self.picks;
+    const size_t* order = ORDERS[self.picks % 16 == 0 ? 2 : self.picks % 4 == 0 ? 1 : 0];
+
+    for (size_t i = 0; i < LANES; ++i)
+        if (TaskNode* node = findInLane(index, order[i])) return node;
+    return nullptr;
+}
+
+ThreadPool::TaskNode* ThreadPool::findInLane(size_t index, size_t lane) {
+    Worker& self = *workers[index];
+    if (TaskNode* node = self.deques[lane].pop()) return node;
+    if (TaskNode* node = takeInjected(index, lane, self.node)) return node;
+    if (TaskNode* node = stealInLane(index, lane, true)) return node;
+    if (nodeCount == 1) return nullptr;
+
+    for (size_t k = 1; k < nodeCount; ++k)
+        if (TaskNode* node = takeInjected(index, lane, (self.node + k) % nodeCount)) return node;
+    return stealInLane(index, lane, false);
+}
+
+// One round over the workers on this worker's node (local) or on all other
+// nodes, in random order (xorshift).
+ThreadPool::TaskNode* ThreadPool::stealInLane(size_t index, size_t lane, bool local) {
+    Worker& self = *workers[index];
+    self.rng ^= self.rng << 13;
+    self.rng ^= self.rng >> 7;
+    self.rng ^= self.rng << 17;
+
+    const size_t n = local ? nodeWorkers[self.node].size() : workers.size();
+    const size_t start = static_cast<size_t>(self.rng % n);
+    for (size_t k = 0; k < n; ++k) {
+        size_t victim = local ? nodeWorkers[self.node][(start + k) % n] : (start + k) % n;
+        if (victim == index || (!local && workers[victim]->node == self.node)) continue;
+        if (TaskNode* node = workers[victim]->deques[lane].steal()) {
+            if (!workers[victim]->deques[lane].empty())
+                wakeOne(static_cast<int>(workers[victim]->node));
+            return node;
+        }
+    }
+    return nullptr;
+}
+
+// Moves up to INJECT_BATCH tasks from `node`'s ring into the worker's deque
+// and returns one of them; a partner is woken to steal the rest.
+ThreadPool::TaskNode* ThreadPool::takeInjected(size_t index, size_t lane, size_t node) {
+    MpmcRing<QueuedTask>& source = ring(node, lane);
+    TaskNode* first = nullptr;
+    size_t moved = 0;
+    QueuedTask queued;
+    while (moved < INJECT_BATCH && source.tryPop(queued)) {
+        TaskNode* taskNode = allocNode(index);
+        taskNode->task = std::move(queued.task);
+        taskNode->group = queued.group;
+        taskNode->lane = lane;
+        if (!first) first = taskNode;
+        else workers[index]->deques[lane].push(taskNode);
+        ++moved;
+    }
+    if (moved > 1 || source.size() > 0) wakeOne(static_cast<int>(workers[index]->node));
+    // Blocked submitters are woken once the ring is half empty, so each
+    // wake-up buys them a run of pushes rather than a single slot.
+    if (moved > 0 && source.size() <= INJECT_CAPACITY / 2) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (roomWaiters.load() > 0) {
+            std::lock_guard<std::mutex> lock(roomMutex);
+            roomFreed.notify_all();
+        }
+    }
+    return first;
+}
+
+bool ThreadPool::hasLaneWork(size_t lane) const {
+    for (size_t node = 0; node < nodeCount; ++node)
+        if (injected[node * LANES + lane]->size() > 0) return true;
+    for (const auto& w : workers)
+        if (!w->deques[lane].empty()) return true;
+    return false;
+}
+
+bool ThreadPool::hasWork() const {
+    for (size_t lane = 0; lane < LANES; ++lane)
+        if (hasLaneWork(lane)) return true;
+    return false;
+}
+
+void ThreadPool::yieldFor(Priority current) {
+    if (currentPool != this) return;
+
+    for (size_t n = 0; n < YIELD_BUDGET; ++n) {
+        TaskNode* node = nullptr;
+        for (size_t lane = 0; lane < static_cast<size_t>(current) && !node; ++lane)
+            if (hasLaneWork(lane)) node = findInLane(currentIndex, lane);
+        if (!node) return;
+        run(node);
+    }
+}
+
+// Returns false when the pool is stopping and no work is left.
+bool ThreadPool::park(size_t index) {
+    Worker& self = *workers[index];
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        idle.push_back(index);
+        idleCount.fetch_add(1, std::memory_order_seq_cst);
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // Re-check after announcing ourselves: a submit that missed us as idle
+    // must have published its task before we look.
+    bool work = hasWork();
+    if (!work && !stop) {
+        std::unique_lock<std::mutex> lock(self.parkMutex);
+        self.parked.wait(lock, [&]() { return self.wake || stop; });
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        auto it = std::find(idle.begin(), idle.end(), index);
+        if (it != idle.end()) {
+            idle.erase(it);
+            idleCount.fetch_sub(1, std::memory_order_seq_cst);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(self.parkMutex);
+        self.wake = false;
+    }
+    return !(stop && !hasWork());
+}
+
+// Prefers a parked worker on `node` when one is given.
+void ThreadPool::wakeOne(int node) {
+    // Orders the caller's task publication before the idle check (see park).
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (idleCount.load(std::memory_order_seq_cst) == 0) return;
+
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        if (idle.empty()) return;
+        auto it = std::prev(idle.end());
+        if (node >= 0 && nodeCount > 1) {
+            auto local = std::find_if(idle.rbegin(), idle.rend(), [&](size_t i) {
+                return workers[i]->node == static_cast<size_t>(node);
+            });
+            if (local != idle.rend()) it = std::prev(local.base());
+        }
+        index = *it;
+        idle.erase(it);
+        idleCount.fetch_sub(1, std::memory_order_seq_cst);
+    }
+    Worker& w = *workers[index];
+    std::lock_guard<std::mutex> lock(w.parkMutex);
+    w.wake = true;
+    w.parked.notify_one();
+}
+
+// ------------------------- Helpers -------------------------
+
+// hardware_concurrency() is allowed to return 0 when it cannot tell.
+size_t hardwareThreads() {
+    return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+bool isELFFile(const fs::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error(std::string("Cannot open file: ") + std::strerror(errno));
+
+    char header[4];
+    file.read(header, 4);
+    if (file.gcount() < 4) return false;
+
+    return (header[0] == 0x7F && header[1] == 'E' &&
+            header[2] == 'L' && header[3] == 'F');
+}
+
+// Load signature into RAM
+std::vector<uint8_t> load_signature(const std::string& path) {
+    if (!fs::is_regular_file(path))
+        throw std::runtime_error("Signature path is not a regular file.");
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("Cannot open signature file: " + path);
+
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), {});
+}
+
+// ------------------------- Per-Thread State -------------------------
+//
+// PerThread<T> gives every thread that calls local() its own T, built by a
+// factory on the thread's first call and kept until the PerThread goes, so
+// the owner can merge all of them afterwards. A thread finds its T again
+// through a thread_local table keyed by the PerThread's id. One thread may
+// use several live instances at once (stdout and two report writers, say)
+// and still has exactly one T in each.
+
+template <typename T>
+class PerThread {
+public:
+    using Factory = std::function<std::unique_ptr<T>()>;
+
+    explicit PerThread(Factory make = []() { return std::unique_ptr<T>(new T()); })
+        : id(nextId.fetch_add(1)), make(std::move(make)) {}
+    PerThread(const PerThread&) = delete;
+    PerThread& operator=(const PerThread&) = delete;
+
+    T& local() {
+        thread_local std::vector<std::pair<uint64_t, T*>> owned;     // instance id -> T
+        for (const auto& [owner, item] : owned)
+            if (owner == id) return *item;
+
+        std::unique_ptr<T> item = make();
+        std::lock_guard<std::mutex> lock(mutex);
+        items.push_back(std::move(item));
+        owned.emplace_back(id, items.back().get());
+        return *items.back();
+    }
+
+    // Calls f(T&) for each thread's T in registration order. Holds the
+    // registration lock, so a thread calling local() for the first time
+    // meanwhile waits.
+    template <typename F>
+    void forEach(F&& f) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& item : items) f(*item);
+    }
+
+private:
+    const uint64_t id;                  // never reused, so stale table entries are harmless
+    const Factory make;
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<T>> items;
+
+    static std::atomic<uint64_t> nextId;
+};
+
+template <typename T>
+std::atomic<uint64_t> PerThread<T>::nextId{1};
+
+// ------------------------- Metrics -------------------------
+//
+// --metrics/--stats: every thread that scans or walks gets its own block of
+// counters and latency histograms, written only by that thread with plain
+// relaxed stores (no locked instructions, no shared cache lines). Readers
+// merge all blocks at report time, so a report may be a few samples behind
+// the workers but never slows them down. Disabled, each phase costs one
+// null-pointer check.
+
+enum class Phase { Walk, Open, Magic, Read, Match, Report };
+constexpr size_t PHASES = 6;
+
+const char* phaseName(Phase phase) {
+    static const char* names[PHASES] = {"walk", "open", "magic", "read", "match", "report"};
+    return names[static_cast<size_t>(phase)];
+}
+
+// Single-writer increment: the owning thread is the only one that stores.
+inline void bump(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// Log-linear buckets in the style of HdrHistogram: SUB buckets per power of
+// two, so a value's bucket bounds are within 12.5% of it, from 1 ns to the
+// full uint64_t range in a fixed 4 KiB.
+class LatencyHistogram {
+public:
+    static constexpr size_t SUB_BITS = 3;
+    static constexpr size_t SUB = size_t(1) << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+    static size_t bucketOf(uint64_t ns) {
+        if (ns < SUB) return static_cast<size_t>(ns);
+        size_t e = 63 - static_cast<size_t>(__builtin_clzll(ns));
+        return (e - SUB_BITS + 1) * SUB + ((ns >> (e - SUB_BITS)) & (SUB - 1));
+    }
+    // Exclusive upper bound of a bucket; saturates for the last one.
+    static uint64_t upperBound(size_t bucket) {
+        if (bucket < SUB) return bucket + 1;
+        size_t shift = bucket / SUB - 1;
+        uint64_t lower = (SUB + bucket % SUB) << shift;
+        uint64_t upper = lower + (uint64_t(1) << shift);
+        return upper > lower ? upper : UINT64_MAX;
+    }
+
+    void record(uint64_t ns) {
+        bump(counts[bucketOf(ns)]);
+        bump(sumNs, ns);
+    }
+
+    // Merged view of several histograms.
+    struct Snapshot {
+        std::vector<uint64_t> counts = std::vector<uint64_t>(BUCKETS);
+        uint64_t total = 0, sumNs = 0;
+
+        // Upper bound of the bucket holding the q-quantile; 0 if empty.
+        uint64_t quantile(double q) const;
+    };
+    void addTo(Snapshot& snapshot) const {
+        for (size_t b = 0; b < BUCKETS; ++b) {
+            uint64_t n = counts[b].load(std::memory_order_relaxed);
+            snapshot.counts[b] += n;
+            snapshot.total += n;
+        }
+        snapshot.sumNs += sumNs.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> counts[BUCKETS] = {};
+    std::atomic<uint64_t> sumNs{0};
+};
+
+uint64_t LatencyHistogram::Snapshot::quantile(double q) const {
+    if (total == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * (total - 1)) + 1, seen = 0;
+    for (size_t b = 0; b < BUCKETS; ++b) {
+        seen += counts[b];
+        if (seen >= rank) return upperBound(b);
+    }
+    return upperBound(BUCKETS - 1);
+}
+
+class ScanMetrics {
+public:
+    // errno values above this are counted in slot 0.
+    static constexpr size_t ERRNO_SLOTS = 134;
+
+    struct alignas(64) ThreadMetrics {
+        std::atomic<uint64_t> files{0}, elfFiles{0}, bytesRead{0}, hits{0};
+        std::atomic<uint64_t> errors[ERRNO_SLOTS] = {};
+        LatencyHistogram phases[PHASES];
+    };
+
+    struct Totals {
+        uint64_t files = 0, elfFiles = 0, bytesRead = 0, hits = 0;
+        std::vector<uint64_t> errors = std::vector<uint64_t>(ERRNO_SLOTS);
+        LatencyHistogram::Snapshot phases[PHASES];
+
+        uint64_t errorCount() const {
+            uint64_t n = 0;
+            for (uint64_t e : errors) n += e;
+            return n;
+        }
+    };
+
+    ScanMetrics() = default;
+    ScanMetrics(const ScanMetrics&) = delete;
+    ScanMetrics& operator=(const ScanMetrics&) = delete;
+
+    // The calling thread's block, registered on first use.
+    ThreadMetrics& local() { return threads.local(); }
+
+    void record(Phase phase, std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now()) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        local().phases[static_cast<size_t>(phase)].record(static_cast<uint64_t>(std::max<int64_t>(ns, 0)));
+    }
+    void addFile(bool elf, uint64_t bytesRead, bool hit, int error);
+    void addError(int error) {
+        bump(local().errors[error > 0 && static_cast<size_t>(error) < ERRNO_SLOTS ? error : 0]);
+    }
+
+    Totals totals() const;
+
+    // Writes the node_exporter textfile format to `path` through a temporary
+    // file and rename(), so the collector never sees half a file.
+    bool writePrometheus(const std::string& path, double elapsedSeconds) const;
+    void printSummary(std::ostream& out, double elapsedSeconds) const;
+
+private:
+    PerThread<ThreadMetrics> threads;
+};
+
+void ScanMetrics::addFile(bool elf, uint64_t bytesRead, bool hit, int error) {
+    ThreadMetrics& t = local();
+    bump(t.files);
+    if (elf) bump(t.elfFiles);
+    bump(t.bytesRead, bytesRead);
+    if (hit) bump(t.hits);
+    if (error) addError(error);
+}
+
+ScanMetrics::Totals ScanMetrics::totals() const {
+    Totals sum;
+    threads.forEach([&sum](const ThreadMetrics& t) {
+        sum.files += t.files.load(std::memory_order_relaxed);
+        sum.elfFiles += t.elfFiles.load(std::memory_order_relaxed);
+        sum.bytesRead += t.bytesRead.load(std::memory_order_relaxed);
+        sum.hits += t.hits.load(std::memory_order_relaxed);
+        for (size_t e = 0; e < ERRNO_SLOTS; ++e)
+            sum.errors[e] += t.errors[e].load(std::memory_order_relaxed);
+        for (size_t p = 0; p < PHASES; ++p) t.phases[p].addTo(sum.phases[p]);
+    });
+    return sum;
+}
+
+bool ScanMetrics::writePrometheus(const std::string& path, double elapsedSeconds) const {
+    Totals t = totals();
+    std::ostringstream out;
+    auto counter = [&out](const char* name, const char* help, uint64_t value) {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " counter\n"
+            << name << " " << value << "\n";
+    };
+    counter("crypty_files_total", "Files scanned.", t.files);
+    counter("crypty_elf_files_total", "Files with an ELF header.", t.elfFiles);
+    counter("crypty_bytes_read_total", "Bytes read from scanned files.", t.bytesRead);
+    counter("crypty_hits_total", "Infected files found.", t.hits);
+
+    out << "# HELP crypty_errors_total Failed opens and stats by errno (0: other).\n"
+        << "# TYPE crypty_errors_total counter\n";
+    for (size_t e = 0; e < ERRNO_SLOTS; ++e)
+        if (t.errors[e]) out << "crypty_errors_total{errno=\"" << e << "\"} " << t.errors[e] << "\n";
+
+    // Cumulative buckets at powers of two from 1 us to ~69 s; the fine
+    // buckets are kept for the quantiles in printSummary().
+    out << "# HELP crypty_phase_seconds Latency of one walk step, open, ELF check, read, match or report.\n"
+        << "# TYPE crypty_phase_seconds histogram\n";
+    for (size_t p = 0; p < PHASES; ++p) {
+        const auto& h = t.phases[p];
+        const char* name = phaseName(static_cast<Phase>(p));
+        uint64_t cumulative = 0;
+        size_t b = 0;
+        for (int shift = 10; shift <= 36; ++shift) {
+            const uint64_t le = uint64_t(1) << shift;
+            while (b < LatencyHistogram::BUCKETS && LatencyHistogram::upperBound(b) <= le)
+                cumulative += h.counts[b++];
+            out << "crypty_phase_seconds_bucket{phase=\"" << name << "\",le=\"" << le / 1e9
+                << "\"} " << cumulative << "\n";
+        }
+        out << "crypty_phase_seconds_bucket{phase=\"" << name << "\",le=\"+Inf\"} " << h.total << "\n"
+            << "crypty_phase_seconds_sum{phase=\"" << name << "\"} " << h.sumNs / 1e9 << "\n"
+            << "crypty_phase_seconds_count{phase=\"" << name << "\"} " << h.total << "\n";
+    }
+    out << "# HELP crypty_scan_elapsed_seconds Time since the scan started.\n"
+        << "# TYPE crypty_scan_elapsed_seconds gauge\n"
+        << "crypty_scan_elapsed_seconds " << elapsedSeconds << "\n";
+
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::trunc);
+        if (!(file << out.str()) || !file.flush()) return false;
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+void ScanMetrics::printSummary(std::ostream& out, double elapsedSeconds) const {
+    Totals t = totals();
+    const double secs = elapsedSeconds > 0 ? elapsedSeconds : 1e-9;
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(2) << "Throughput: " << t.bytesRead / secs / 1e9
+         << " GB/s read, " << std::setprecision(0) << t.files / secs << " files/s (" << t.files
+         << " files, " << t.elfFiles << " ELF, " << t.hits << " infected, " << t.errorCount()
+         << " errors).\n";
+    text << std::setprecision(1);
+    for (size_t p = 0; p < PHASES; ++p) {
+        const auto& h = t.phases[p];
+        if (h.total == 0) continue;
+        text << "  " << std::left << std::setw(6) << phaseName(static_cast<Phase>(p)) << std::right
+             << std::setw(10) << h.total << " x  p50 " << h.quantile(0.5) / 1e3 << " us  p99 "
+             << h.quantile(0.99) / 1e3 << " us  max " << h.quantile(1.0) / 1e3 << " us  total "
+             << h.sumNs / 1e9 << " s\n";
+    }
+    for (size_t e = 0; e < ERRNO_SLOTS; ++e)
+        if (t.errors[e])
+            text << "  errno " << e << " (" << (e ? std::strerror(static_cast<int>(e)) : "other")
+                 << "): " << t.errors[e] << "\n";
+    out << text.str();
+}
+
+// Time one file spent in each phase, for the --slowest report. Ranges of
+// a split file add to it from several threads.
+struct FilePhases {
+    std::atomic<uint64_t> ns[PHASES] = {};
+};
+
+// ------------------------- Tracing -------------------------
+//
+// --trace <file>: phase spans of sampled files are kept in per-thread rings
+// allocated once at registration and written as Chrome trace-event JSON
+// (chrome://tracing, ui.perfetto.dev) after the scan. Recording a span is
+// two clock reads and a store into the thread's own ring; a full ring
+// overwrites its oldest spans. Files are sampled by a hash of their inode,
+// so every phase of a sampled file is traced on whichever thread runs it
+// and unsampled files cost a null-pointer check. Spans carry the inode,
+// which --jsonl maps back to a path.
+
+class TraceRecorder {
+public:
+    static constexpr size_t RING_EVENTS = 1 << 16;    // per thread, 2 MiB
+
+    // Traces roughly one file in `sampleEvery`.
+    explicit TraceRecorder(uint64_t sampleEvery)
+        : sampleEvery(std::max<uint64_t>(1, sampleEvery)) {}
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    bool sampled(uint64_t file) const {
+        return sampleEvery == 1 || (file * 0x9E3779B97F4A7C15ULL >> 32) % sampleEvery == 0;
+    }
+
+    void add(Phase phase, std::chrono::steady_clock::time_point start,
+             std::chrono::steady_clock::time_point end, uint64_t file);
+
+    // Writes all rings as {"traceEvents": [...]}; call once the workers are
+    // idle. Returns false if the file cannot be written.
+    bool write(const std::string& path) const;
+
+private:
+    struct Event {
+        int64_t startNs;                    // since `origin`
+        int64_t durationNs;
+        uint64_t file;
+        Phase phase;
+    };
+    struct Ring {
+        std::unique_ptr<Event[]> events{new Event[RING_EVENTS]};
+        std::atomic<uint64_t> count{0};     // events ever added
+    };
+
+    const uint64_t sampleEvery;
+    const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    PerThread<Ring> rings;
+};
+
+void TraceRecorder::add(Phase phase, std::chrono::steady_clock::time_point start,
+                        std::chrono::steady_clock::time_point end, uint64_t file) {
+    Ring& ring = rings.local();
+    uint64_t n = ring.count.load(std::memory_order_relaxed);
+    ring.events[n % RING_EVENTS] = {
+        std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin).count(),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(), file, phase};
+    ring.count.store(n + 1, std::memory_order_release);
+}
+
+bool TraceRecorder::write(const std::string& path) const {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) return false;
+    const int pid = static_cast<int>(::getpid());
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    char number[32];
+    // Microseconds with nanosecond precision, as the format expects.
+    auto micros = [&number](int64_t ns) {
+        std::snprintf(number, sizeof(number), "%.3f", ns / 1e3);
+        return number;
+    };
+    size_t tid = 0;
+    rings.forEach([&](const Ring& ring) {
+        out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+            << ",\"tid\":" << tid << ",\"args\":{\"name\":\"thread " << tid << "\"}}";
+        first = false;
+        const uint64_t count = ring.count.load(std::memory_order_acquire);
+        for (uint64_t i = count > RING_EVENTS ? count - RING_EVENTS : 0; i < count; ++i) {
+            const Event& e = ring.events[i % RING_EVENTS];
+            out << ",\n{\"name\":\"" << phaseName(e.phase) << "\",\"cat\":\"scan\",\"ph\":\"X\",\"ts\":"
+                << micros(e.startNs);
+            out << ",\"dur\":" << micros(e.durationNs) << ",\"pid\":" << pid << ",\"tid\":" << tid
+                << ",\"args\":{\"inode\":" << e.file << "}}";
+        }
+        ++tid;
+    });
+    out << "\n]}\n";
+    return static_cast<bool>(out.flush());
+}
+
+// ------------------------- Live Stats -------------------------
+//
+// --stats-shm <name>: a StatsBlock (crypty_stats.h) in POSIX shared memory
+// for crypty-top. Each worker thread owns one slot and rewrites it under the
+// slot's seqlock when it enters a phase or finishes a file; the main thread
+// rewrites the totals on every progress tick. Publishing is plain stores
+// into the mapping: no syscall, no lock, nothing shared between workers.
+
+class LiveStats {
+public:
+    // Creates (or replaces) the segment; throws if it cannot be mapped.
+    explicit LiveStats(const std::string& name);
+    ~LiveStats();
+    LiveStats(const LiveStats&) = delete;
+    LiveStats& operator=(const LiveStats&) = delete;
+
+    // Worker side. The path is copied only when the thread moves to
+    // another file.
+    void enter(Phase phase, const fs::path* file, uint64_t fileId);
+    void leave();
+    void fileDone(uint64_t bytesRead, bool hit);
+
+    // Main thread only.
+    template <typename Update>
+    void publish(Update&& update) {
+        crypty_stats::seqWrite(block->seq, block->totals, [&](crypty_stats::Totals& totals) {
+            update(totals);
+            totals.updatedUnixMs = unixMillis();
+        });
+    }
+
+    static uint64_t unixMillis() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+private:
+    struct Local {
+        crypty_stats::WorkerSlot* slot = nullptr;   // null once all slots are taken
+        const fs::path* file = nullptr;
+        uint64_t fileId = 0;
+    };
+
+    const std::string name;
+    crypty_stats::StatsBlock* block;
+    PerThread<Local> locals;                // each claims the next worker slot
+
+    Local& local() { return locals.local(); }
+};
+
+LiveStats::LiveStats(const std::string& name)
+    : name(name), locals([this]() {
+          std::unique_ptr<Local> l(new Local());
+          uint32_t index = block->workers.fetch_add(1);
+          if (index < crypty_stats::MAX_WORKERS) l->slot = &block->worker[index];
+          return l;
+      }) {
+    int fd = ::shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) throw std::runtime_error("Cannot create shared memory " + name + ": " + std::strerror(errno));
+    void* map = MAP_FAILED;
+    if (::ftruncate(fd, sizeof(crypty_stats::StatsBlock)) == 0)
+        map = ::mmap(nullptr, sizeof(crypty_stats::StatsBlock), PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+    int error = errno;
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        ::shm_unlink(name.c_str());
+        throw std::runtime_error("Cannot map shared memory " + name + ": " + std::strerror(error));
+    }
+    // The fresh mapping is zero-filled, which is a valid empty block.
+    block = static_cast<crypty_stats::StatsBlock*>(map);
+    block->pid = static_cast<uint32_t>(::getpid());
+    block->version = crypty_stats::VERSION;
+    publish([](crypty_stats::Totals& totals) { totals.startedUnixMs = unixMillis(); });
+    std::atomic_thread_fence(std::memory_order_release);
+    block->magic = crypty_stats::MAGIC;     // readers wait for this
+}
+
+LiveStats::~LiveStats() {
+    publish([](crypty_stats::Totals& totals) { totals.finished = 1; });
+    ::munmap(block, sizeof(crypty_stats::StatsBlock));
+    ::shm_unlink(name.c_str());             // attached readers keep their mapping
+}
+
+void LiveStats::enter(Phase phase, const fs::path* file, uint64_t fileId) {
+    Local& l = local();
+    if (!l.slot) return;
+    const bool moved = file && (file != l.file || fileId != l.fileId);
+    crypty_stats::seqWrite(l.slot->seq, l.slot->data, [&](crypty_stats::Worker& w) {
+        w.state = static_cast<uint32_t>(phase) + crypty_stats::WALK;
+        if (!moved) return;
+        // Keep the end of long paths: the file name matters most.
+        const std::string& path = file->native();
+        size_t n = std::min(path.size(), crypty_stats::PATH_SIZE - 1);
+        std::memcpy(w.file, path.data() + path.size() - n, n);
+        w.file[n] = '\0';
+        if (n < path.size()) std::memcpy(w.file, "...", 3);
+    });
+    if (moved) {
+        l.file = file;
+        l.fileId = fileId;
+    }
+}
+
+void LiveStats::leave() {
+    Local& l = local();
+    if (!l.slot) return;
+    crypty_stats::seqWrite(l.slot->seq, l.slot->data,
+                           [](crypty_stats::Worker& w) { w.state = crypty_stats::IDLE; });
+}
+
+void LiveStats::fileDone(uint64_t bytesRead, bool hit) {
+    Local& l = local();
+    if (!l.slot) return;
+    crypty_stats::seqWrite(l.slot->seq, l.slot->data, [&](crypty_stats::Worker& w) {
+        w.state = crypty_stats::IDLE;
+        ++w.filesDone;
+        w.bytesRead += bytesRead;
+        if (hit) ++w.hits;
+    });
+    l.file = nullptr;                       // the next file is always published
+}
+
+// ------------------------- Hardware Counters -------------------------
+//
+// --perf-counters: cycles, instructions, cache misses and branch misses of
+// the match phase, from perf_event_open counters each thread opens for
+// itself on first use (user space only, so perf_event_paranoid=2 works).
+// Every match reads the group before and after (two read(2) calls) and
+// adds the difference to the thread's own totals for the scan engine and
+// the file's size bucket; totals are merged for the end-of-scan table.
+// Without a PMU (VMs, containers) the first open fails and the option only
+// prints why.
+
+enum class Engine { Pool, Split, Batch, Pipeline, Coroutine };
+constexpr size_t ENGINES = 5;
+
+const char* engineName(Engine engine) {
+    static const char* names[ENGINES] = {"pool", "split", "batch", "pipeline", "coroutine"};
+    return names[static_cast<size_t>(engine)];
+}
+
+constexpr size_t SIZE_BUCKETS = 5;
+const char* const SIZE_BUCKET_NAMES[SIZE_BUCKETS] = {"<64K", "<1M", "<16M", "<256M", ">=256M"};
+
+size_t sizeBucketOf(uint64_t size) {
+    size_t bucket = 0;
+    for (uint64_t limit = 64 << 10; bucket + 1 < SIZE_BUCKETS && size >= limit; limit <<= 4)
+        ++bucket;
+    return bucket;
+}
+
+class PerfCounters {
+public:
+    static constexpr size_t EVENTS = 4;     // cycles, instructions, cache misses, branch misses
+
+    struct Reading {
+        bool valid = false;
+        uint64_t value[EVENTS] = {};
+    };
+
+    PerfCounters() : threads([this]() { return open(); }) {}
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // Current counts of the calling thread; invalid without counters.
+    Reading read();
+    // Adds what the calling thread counted since `before` for `bytes` matched.
+    void add(const Reading& before, Engine engine, uint64_t fileSize, uint64_t bytes);
+    void printSummary(std::ostream& out) const;
+
+private:
+    struct alignas(64) ThreadCounters {
+        int fd[EVENTS] = {-1, -1, -1, -1};      // fd[0] leads the group
+        int slot[EVENTS] = {-1, -1, -1, -1};    // position in a group read; -1 if missing
+        size_t opened = 0;
+        // Per engine and size bucket: bytes, then one total per event.
+        std::atomic<uint64_t> totals[ENGINES][SIZE_BUCKETS][EVENTS + 1] = {};
+    };
+
+    mutable std::mutex mutex;               // `unavailable` only
+    std::string unavailable;                // why the first thread got no counters
+    PerThread<ThreadCounters> threads;      // last: its factory uses the above
+
+    // Opens the calling thread's counter group.
+    std::unique_ptr<ThreadCounters> open();
+    ThreadCounters& local() { return threads.local(); }
+};
+
+PerfCounters::~PerfCounters() {
+    threads.forEach([](ThreadCounters& t) {
+        for (int fd : t.fd)
+            if (fd >= 0) ::close(fd);
+    });
+}
+
+std::unique_ptr<PerfCounters::ThreadCounters> PerfCounters::open() {
+    std::unique_ptr<ThreadCounters> t(new ThreadCounters());
+#ifdef __linux__
+    static const uint64_t configs[EVENTS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                             PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    for (size_t e = 0; e < EVENTS; ++e) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[e];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        t->fd[e] = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, t->fd[0],
+                                              PERF_FLAG_FD_CLOEXEC));
+        if (t->fd[e] >= 0) {
+            t->slot[e] = static_cast<int>(t->opened++);
+        } else if (e == 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (unavailable.empty()) unavailable = std::strerror(errno);
+            break;
+        }
+        // Otherwise this PMU lacks the event and the group goes without it.
+    }
+#endif
+    return t;
+}
+
+PerfCounters::Reading PerfCounters::read() {
+    Reading reading;
+    const ThreadCounters& t = local();
+    if (t.fd[0] < 0) return reading;
+    // nr, time enabled, time running, then one value per opened event.
+    uint64_t buffer[3 + EVENTS];
+    ssize_t n = ::read(t.fd[0], buffer, sizeof(buffer));
+    if (n < static_cast<ssize_t>((3 + t.opened) * sizeof(uint64_t))) return reading;
+    // Scale up if the kernel had to multiplex the group.
+    const double scale = buffer[2] && buffer[2] < buffer[1] ? double(buffer[1]) / buffer[2] : 1.0;
+    for (size_t e = 0; e < EVENTS; ++e)
+        if (t.slot[e] >= 0) reading.value[e] = static_cast<uint64_t>(buffer[3 + t.slot[e]] * scale);
+    reading.valid = true;
+    return reading;
+}
+
+void PerfCounters::add(const Reading& before, Engine engine, uint64_t fileSize, uint64_t bytes) {
+    if (!before.valid) return;
+    Reading after = read();
+    if (!after.valid) return;
+    auto& totals = local().totals[static_cast<size_t>(engine)][sizeBucketOf(fileSize)];
+    bump(totals[0], bytes);
+    for (size_t e = 0; e < EVENTS; ++e)
+        if (after.value[e] > before.value[e]) bump(totals[e + 1], after.value[e] - before.value[e]);
+}
+
+void PerfCounters::printSummary(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!unavailable.empty()) {
+        out << "Hardware counters unavailable: " << unavailable << ".\n";
+        return;
+    }
+    bool missing[EVENTS] = {};
+    threads.forEach([&missing](const ThreadCounters& t) {
+        for (size_t e = 0; e < EVENTS; ++e) missing[e] = missing[e] || t.slot[e] < 0;
+    });
+
+    std::ostringstream text;
+    text << "Hardware counters while matching (user space):\n"
+         << "  engine     size          MiB  cycles/B    IPC  cache-miss/KiB  branch-miss/KiB\n"
+         << std::fixed;
+    for (size_t engine = 0; engine < ENGINES; ++engine) {
+        for (size_t bucket = 0; bucket < SIZE_BUCKETS; ++bucket) {
+            uint64_t sum[EVENTS + 1] = {};
+            threads.forEach([&](const ThreadCounters& t) {
+                for (size_t k = 0; k <= EVENTS; ++k)
+                    sum[k] += t.totals[engine][bucket][k].load(std::memory_order_relaxed);
+            });
+            if (sum[0] == 0) continue;
+            const double bytes = double(sum[0]);
+            auto column = [&](bool available, double value, int width) {
+                text << std::setw(width);
+                if (available) text << value;
+                else text << "n/a";
+            };
+            text << "  " << std::left << std::setw(10) << engineName(static_cast<Engine>(engine))
+                 << std::setw(8) << SIZE_BUCKET_NAMES[bucket] << std::right << std::setprecision(1)
+                 << std::setw(9) << bytes / 1048576.0 << std::setprecision(2);
+            column(!missing[0], sum[1] / bytes, 10);
+            column(!missing[0] && !missing[1] && sum[1], double(sum[2]) / (sum[1] ? sum[1] : 1), 7);
+            column(!missing[2], sum[3] * 1024.0 / bytes, 16);
+            column(!missing[3], sum[4] * 1024.0 / bytes, 17);
+            text << "\n";
+        }
+    }
+    out << text.str();
+}
+
+// ------------------------- Cancellation -------------------------
+
+// Cooperative cancellation flag. A child token also reports cancelled once
+// its parent is, so a per-file token (e.g. split ranges) follows the scan.
+class CancellationToken {
+public:
+    explicit CancellationToken(const CancellationToken* parent = nullptr) : parent(parent) {}
+
+    void cancel() { flag.store(true, std::memory_order_relaxed); }
+
+    // True only for the call that actually cancelled the token.
+    bool cancelFirst() { return !flag.exchange(true); }
+
+    bool cancelled() const {
+        return flag.load(std::memory_order_relaxed) || (parent && parent->cancelled());
+    }
+
+private:
+    const CancellationToken* parent;
+    std::atomic<bool> flag{false};
+};
+
+// Unreadable: an open or read failed, so a clean result cannot be trusted.
+enum class StopReason { None, Cancelled, Deadline, ByteBudget, Unreadable };
+
+const char* stopReasonName(StopReason reason) {
+    switch (reason) {
+        case StopReason::Cancelled:  return "cancelled";
+        case StopReason::Deadline:   return "time budget exceeded";
+        case StopReason::ByteBudget: return "byte budget exceeded";
+        case StopReason::Unreadable: return "unreadable";
+        default:                     return "complete";
+    }
+}
+
+// Per-file limits checked between chunks; `stopped` says why a search ended
+// early (None when it ran to a match or to the end of the data). With `pool`
+// set, the search also yields to higher-priority tasks between chunks.
+struct ScanLimits {
+    const CancellationToken* token = nullptr;
+    ThreadPool* pool = nullptr;
+    Priority priority = Priority::Normal;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    uint64_t maxBytes = UINT64_MAX;
+    StopReason stopped = StopReason::None;
+    uint64_t bytesRead = 0;             // set by searchChunks
+    size_t readSize = 0;                // bytes per read; 0 = default window
+    ScanMetrics* metrics = nullptr;     // phase latencies when set
+    TraceRecorder* trace = nullptr;     // phase spans when set (sampled files only)
+    uint64_t fileId = 0;                // inode: names the file in spans and live stats
+    LiveStats* live = nullptr;          // per-worker state when set
+    const fs::path* file = nullptr;     // shown by live stats; must outlive the scan
+    PerfCounters* perf = nullptr;       // hardware counters around matching when set
+    Engine engine = Engine::Pool;       // which scan path, for the counter table
+    uint64_t fileSize = 0;              // picks the counter table's size bucket
+    std::shared_ptr<FilePhases> phases; // per-file phase times when set (--slowest)
+    int error = 0;                      // errno of a failed open or read
+};
+
+// Times one phase while in scope, into the metrics, the trace and/or the
+// file's phase totals; with none enabled it does not read the clock. A Match
+// timer given the bytes it covers also reads the hardware counters when
+// they are on.
+class PhaseTimer {
+public:
+    PhaseTimer(ScanMetrics* metrics, TraceRecorder* trace, uint64_t file, Phase phase)
+        : metrics(metrics), trace(trace), file(file), phase(phase) {
+        if (metrics || trace) start = std::chrono::steady_clock::now();
+    }
+    PhaseTimer(const ScanLimits* limits, Phase phase, uint64_t bytes = 0)
+        : PhaseTimer(limits ? limits->metrics : nullptr, limits ? limits->trace : nullptr,
+                     limits ? limits->fileId : 0, phase) {
+        live = limits ? limits->live : nullptr;
+        if (live) live->enter(phase, limits->file, limits->fileId);
+        phases = limits ? limits->phases.get() : nullptr;
+        if (phases && !metrics && !trace) start = std::chrono::steady_clock::now();
+        if (limits && limits->perf && bytes) {
+            counters = limits;
+            matched = bytes;
+            before = limits->perf->read();
+        }
+    }
+    ~PhaseTimer() {
+        if (counters) counters->perf->add(before, counters->engine, counters->fileSize, matched);
+        if (live) live->leave();
+        if (!metrics && !trace && !phases) return;
+        auto end = std::chrono::steady_clock::now();
+        if (metrics) metrics->record(phase, start, end);
+        if (trace) trace->add(phase, start, end, file);
+        if (phases)
+            phases->ns[static_cast<size_t>(phase)].fetch_add(
+                static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()),
+                std::memory_order_relaxed);
+    }
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    ScanMetrics* metrics;
+    TraceRecorder* trace;
+    LiveStats* live = nullptr;
+    FilePhases* phases = nullptr;
+    const ScanLimits* counters = nullptr;
+    uint64_t matched = 0;
+    PerfCounters::Reading before;
+    uint64_t file;
+    Phase phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Scan windows come from a small per-thread arena instead of one allocation
+// per file. Pinned workers (--numa) first-touch them on their own node, so
+// reads land in node-local memory. Leases nest: yieldFor() can run another
+// scan on a thread whose current scan is suspended between chunks.
+class ScanBuffer {
+public:
+    explicit ScanBuffer(size_t size) {
+        if (arena.size() == depth) arena.emplace_back();
+        buffer = &arena[depth];
+        if (buffer->size() < size) buffer->resize(size);
+        ++depth;                    // only once the slot is usable; resize may throw
+    }
+    ~ScanBuffer() { --depth; }
+    ScanBuffer(const ScanBuffer&) = delete;
+    ScanBuffer& operator=(const ScanBuffer&) = delete;
+
+    uint8_t* data() { return buffer->data(); }
+
+private:
+    std::vector<uint8_t>* buffer;
+    static thread_local std::deque<std::vector<uint8_t>> arena;    // stable addresses
+    static thread_local size_t depth;
+};
+
+thread_local std::deque<std::vector<uint8_t>> ScanBuffer::arena;
+thread_local size_t ScanBuffer::depth = 0;
+
+// The sliding-window matcher as a step machine, so the blocking scanners and
+// the coroutine core drive the same code. Per chunk: proceed() checks
+// cancellation and budgets, the caller reads up to chunkSize() bytes into
+// readTarget(window) and passes the count to consume(). `window` must hold
+// windowSize() bytes and stay the same for the whole scan.
+class ChunkMatcher {
+public:
+    ChunkMatcher(const std::vector<uint8_t>& signature, ScanLimits* limits)
+        : signature(signature),
+          limits(limits),
+          overlap(signature.empty() ? 0 : signature.size() - 1),
+          //buffer size should be bigger then signature
+          chunk(std::max({MIN_BUFFER_SIZE, signature.size() + EXTRA_BUFFER,
+                          limits ? limits->readSize : size_t(0)})) {}
+
+    size_t windowSize() const { return chunk + overlap; }
+    size_t chunkSize() const { return chunk; }
+    uint8_t* readTarget(uint8_t* window) const { return window + overlap; }
+
+    // False when the scan must stop before the next read.
+    bool proceed();
+    // False once the scan is over: a hit, end of data or the byte budget.
+    bool consume(uint8_t* window, size_t bytesRead);
+    // Offset of the first match relative to the first byte read, or -1.
+    int64_t result() const { return hit; }
+
+private:
+    const std::vector<uint8_t>& signature;
+    ScanLimits* limits;
+    const size_t overlap;
+    const size_t chunk;
+    size_t carried = 0;     // valid tail bytes kept from the previous chunk
+    uint64_t base = 0;      // stream offset of window[overlap]
+    int64_t hit = -1;
+};
+
+bool ChunkMatcher::proceed() {
+    if (signature.empty()) return false;
+    if (!limits) return true;
+
+    if (limits->pool && limits->priority != Priority::Interactive && base > 0)
+        limits->pool->yieldFor(limits->priority);
+    if (limits->token && limits->token->cancelled())
+        limits->stopped = StopReason::Cancelled;
+    else if (base > 0 && std::chrono::steady_clock::now() > limits->deadline)
+        limits->stopped = StopReason::Deadline;
+    return limits->stopped == StopReason::None;
+}
+
+bool ChunkMatcher::consume(uint8_t* window, size_t bytesRead) {
+    if (limits) limits->bytesRead += bytesRead;
+    PhaseTimer timer(limits, Phase::Match, bytesRead);
+
+    const uint8_t* first = window + (overlap - carried);
+    const uint8_t* last = window + overlap + bytesRead;
+    const uint8_t* it = std::search(first, last, signature.begin(), signature.end());
+    if (it != last) {
+        hit = static_cast<int64_t>(base + (it - window)) - static_cast<int64_t>(overlap);
+        return false;
+    }
+
+    if (bytesRead < chunk) return false;
+
+    std::copy(last - overlap, last, window);
+    carried = overlap;
+    base += bytesRead;
+
+    if (limits && base >= limits->maxBytes) {
+        limits->stopped = StopReason::ByteBudget;
+        return false;
+    }
+    return true;
+}
+
+// Blocking driver for ChunkMatcher. `readChunk(dst, n)` must fill up to n
+// bytes and return how many it wrote; fewer than n means end of data.
+// Returns the offset of the first match or -1.
+template <typename ReadChunk>
+int64_t searchChunks(ReadChunk&& readChunk, const std::vector<uint8_t>& signature,
+                     ScanLimits* limits = nullptr) {
+    ChunkMatcher matcher(signature, limits);
+    ScanBuffer window(matcher.windowSize());
+    while (matcher.proceed()) {
+        size_t bytesRead;
+        {
+            PhaseTimer timer(limits, Phase::Read);
+            bytesRead = readChunk(matcher.readTarget(window.data()), matcher.chunkSize());
+        }
+        if (!matcher.consume(window.data(), bytesRead)) break;
+    }
+    return matcher.result();
+}
+
+// Buffered read with sliding window
+bool containsSignatureBuffered(const fs::path& path, const std::vector<uint8_t>& signature,
+                               ScanLimits* limits = nullptr) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error(std::string("Cannot open file: ") + std::strerror(errno));
+
+    return searchChunks([&file](uint8_t* dst, size_t n) {
+        file.read(reinterpret_cast<char*>(dst), n);
+        return static_cast<size_t>(file.gcount());
+    }, signature, limits) >= 0;
+}
+
+// Reads up to n bytes at offset, retrying short reads; returns bytes read.
+// A read error ends it early like end of file; its errno goes to `error`.
+size_t preadFull(int fd, uint8_t* dst, size_t n, off_t offset, int* error = nullptr) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t r = ::pread(fd, dst + done, n - done, offset + static_cast<off_t>(done));
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && error) *error = errno;
+        if (r <= 0) break;
+        done += static_cast<size_t>(r);
+    }
+    return done;
+}
+
+// fd-based variants, used where the file is already open (on-access events).
+// They never re-resolve a path and do not move the fd's file offset.
+bool isELFFile(int fd) {
+    uint8_t header[4];
+    if (preadFull(fd, header, 4, 0) < 4) return false;
+
+    return (header[0] == 0x7F && header[1] == 'E' &&
+            header[2] == 'L' && header[3] == 'F');
+}
+
+// ELF class from a file's first bytes: 32 or 64, 0 if the class byte is
+// missing or unknown, -1 if the magic does not match.
+int elfClassOf(const uint8_t* header, size_t n) {
+    if (n < 4 || header[0] != 0x7F || header[1] != 'E' || header[2] != 'L' || header[3] != 'F')
+        return -1;
+    if (n < 5) return 0;
+    return header[4] == 1 ? 32 : header[4] == 2 ? 64 : 0;
+}
+
+int openForScan(const fs::path& path, const ScanLimits* limits = nullptr) {
+    PhaseTimer timer(limits, Phase::Open);
+    return ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+// Closes a scanned file's fd on scope exit, also when the scan throws.
+struct FdCloser {
+    int fd;
+    ~FdCloser() {
+        if (fd >= 0) ::close(fd);
+    }
+};
+
+int readElfClass(int fd, const ScanLimits* limits = nullptr, int* error = nullptr) {
+    PhaseTimer timer(limits, Phase::Magic);
+    uint8_t header[5];
+    return elfClassOf(header, preadFull(fd, header, sizeof(header), 0, error));
+}
+
+// Returns the offset of the first match or -1.
+int64_t findSignatureFd(int fd, const std::vector<uint8_t>& signature,
+                        ScanLimits* limits = nullptr) {
+    off_t offset = 0;
+    int* error = limits ? &limits->error : nullptr;
+    return searchChunks([fd, &offset, error](uint8_t* dst, size_t n) {
+        size_t got = preadFull(fd, dst, n, offset, error);
+        offset += static_cast<off_t>(got);
+        return got;
+    }, signature, limits);
+}
+
+bool containsSignatureFd(int fd, const std::vector<uint8_t>& signature,
+                         ScanLimits* limits = nullptr) {
+    return findSignatureFd(fd, signature, limits) >= 0;
+}
+
+// Searches for a match that starts in [begin, end), reading at most
+// signature.size()-1 bytes past end. Returns the absolute offset or -1.
+int64_t findSignatureInRange(int fd, uint64_t begin, uint64_t end,
+                             const std::vector<uint8_t>& signature,
+                             ScanLimits* limits) {
+    const uint64_t limit = end + signature.size() - 1;
+    uint64_t offset = begin;
+    int* error = limits ? &limits->error : nullptr;
+    int64_t hit = searchChunks([fd, &offset, limit, error](uint8_t* dst, size_t n) {
+        size_t want = static_cast<size_t>(std::min<uint64_t>(n, limit - offset));
+        size_t got = preadFull(fd, dst, want, static_cast<off_t>(offset), error);
+        offset += got;
+        return got;
+    }, signature, limits);
+    return hit < 0 ? -1 : static_cast<int64_t>(begin) + hit;
+}
+
+// ------------------------- Intra-File Parallel Scan -------------------------
+//
+// A file of at least --split-mib MiB is cut into SPLIT_RANGE ranges that are
+// scanned as separate pool tasks. Each range reads signature.size()-1 bytes
+// into its successor, so a match straddling a boundary is still seen, and it
+// can only report matches that *start* inside it: a hit in an overlap is
+// owned by exactly one range. A hit lowers the file's first-match offset
+// and cancels only the ranges after it, each through its own token that
+// also follows the scan-wide one; the file is reported once its last range
+// is done, so the offset is the first match in the file.
+
+constexpr uint64_t SPLIT_RANGE = 64ULL << 20;
+
+// What the scan of one file found out. Fields a scanner did not learn stay 0.
+struct FileResult {
+    const fs::path& path;
+    int64_t hit = -1;                       // offset of the first match, -1 if clean
+    StopReason reason = StopReason::None;   // why a clean file was not fully scanned
+    uint64_t size = 0;
+    uint64_t inode = 0;
+    bool elf = false;
+    int elfClass = 0;                       // 32 or 64; 0 if unknown
+    uint64_t bytesRead = 0;
+    uint64_t scanNs = 0;
+    bool cached = false;                    // infected per --state, not read this run
+    int error = 0;                          // errno of a failed open or read
+    const FilePhases* phases = nullptr;     // time per phase, with --slowest
+
+    explicit FileResult(const fs::path& path, int64_t hit = -1,
+                        StopReason reason = StopReason::None)
+        : path(path), hit(hit), reason(reason) {}
+
+    void setElfClass(int cls) {
+        elf = cls >= 0;
+        elfClass = std::max(cls, 0);
+    }
+    // Call once hit and reason are set: a file that could not be read
+    // is reported unreadable, never clean.
+    void setError(int err) {
+        error = err;
+        if (err && hit < 0) reason = StopReason::Unreadable;
+    }
+    void setElapsed(std::chrono::steady_clock::time_point start) {
+        scanNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+};
+
+// From a catch block around a scan: the errno its file is reported
+// unreadable with. Out of memory is ENOMEM, anything else EIO.
+int scanFailureError() {
+    try {
+        throw;
+    } catch (const std::bad_alloc&) {
+        return ENOMEM;
+    } catch (...) {
+        return EIO;
+    }
+}
+
+// Called once per file.
+using FileResultFn = std::function<void(const FileResult&)>;
+
+// A file queued for scanning, with its size and inode when known (0 otherwise).
+struct ScanItem {
+    fs::path path;
+    uint64_t size = 0;
+    uint64_t inode = 0;
+    uint64_t dev = 0;       // st_dev, for --numa placement
+};
+
+// scanFile() for a file the caller has opened; fd is left open.
+void scanOpenFile(int fd, const std::vector<uint8_t>& signature, ScanLimits& limits,
+                  FileResult& result) {
+    result.setElfClass(readElfClass(fd, &limits, &limits.error));
+    if (result.elf) result.hit = findSignatureFd(fd, signature, &limits);
+    result.reason = result.hit >= 0 ? StopReason::None : limits.stopped;
+    result.bytesRead = limits.bytesRead;
+    result.setError(limits.error);
+}
+
+// Scans one file through a single fd and fills `result`: ELF class, first
+// match, bytes read and why it stopped early. A failed open or read comes
+// back as Unreadable with its errno.
+void scanFile(const fs::path& path, const std::vector<uint8_t>& signature, ScanLimits& limits,
+              FileResult& result) {
+    result.phases = limits.phases.get();
+    int fd = openForScan(path, &limits);
+    if (fd < 0) {
+        result.setError(errno);
+        return;
+    }
+    FdCloser closer{fd};
+    scanOpenFile(fd, signature, limits, result);
+}
+
+// The same checks on data already in memory.
+void scanBuffer(const uint8_t* data, size_t size, const std::vector<uint8_t>& signature,
+                FileResult& result) {
+    result.size = size;
+    result.setElfClass(elfClassOf(data, size));
+    if (result.elf && !signature.empty()) {
+        const uint8_t* it = std::search(data, data + size, signature.begin(), signature.end());
+        if (it != data + size) result.hit = it - data;
+        result.bytesRead = size;
+    }
+}
+
+struct SplitScan {
+    int fd;
+    fs::path path;
+    uint64_t size = 0, inode = 0;
+    int elfClass = 0;
+    std::chrono::steady_clock::time_point started;
+    std::atomic<uint64_t> bytesRead{0};
+    ScanLimits instruments;             // metrics, trace and live stats of the file
+    std::deque<CancellationToken> rangeTokens;  // one per range, after the scan-wide token
+    std::atomic<int64_t> firstHit{INT64_MAX};   // lowest match offset so far
+    std::atomic<size_t> remaining{0};
+    std::atomic<int> worstStop{static_cast<int>(StopReason::None)};
+    std::atomic<int> error{0};                  // errno of a failed range read
+    TaskGroup* group = nullptr;
+    FileResultFn onDone;
+
+    ~SplitScan() { ::close(fd); }
+
+    void noteStop(StopReason reason) {
+        int r = static_cast<int>(reason), seen = worstStop.load();
+        while (r > seen && !worstStop.compare_exchange_weak(seen, r)) {}
+    }
+
+    void report(int64_t hit, StopReason reason) {
+        FileResult result(path, hit, reason);
+        result.size = size;
+        result.inode = inode;
+        result.setElfClass(elfClass);
+        result.bytesRead = bytesRead.load();
+        result.setError(error.load());
+        result.phases = instruments.phases.get();
+        result.setElapsed(started);
+        onDone(result);
+    }
+
+    // Ranges starting after `hit` cannot hold the first match.
+    void noteHit(int64_t hit) {
+        int64_t seen = firstHit.load();
+        while (hit < seen && !firstHit.compare_exchange_weak(seen, hit)) {}
+        for (size_t r = static_cast<size_t>(hit / SPLIT_RANGE) + 1; r < rangeTokens.size(); ++r)
+            rangeTokens[r].cancel();
+    }
+
+    void finishRange(uint64_t bytes) {
+        if (group) group->addBytes(bytes);
+        if (remaining.fetch_sub(1) != 1) return;
+        const int64_t hit = firstHit.load();
+        if (hit != INT64_MAX) report(hit, StopReason::None);
+        else report(-1, static_cast<StopReason>(worstStop.load()));
+        if (group) group->addFile(0);
+    }
+};
+
+// Opens the file, checks the ELF magic and queues its ranges into `group`,
+// which counts the file as done once its last range finishes. The deadline
+// in `limits` covers the whole file; its byte budget caps the ranges queued.
+// A file that cannot be opened or read is reported through onDone as
+// unreadable right away, so no outcome depends on the caller checking.
+void scanFileSplit(ThreadPool& pool, TaskGroup* group, const ScanItem& item,
+                   const std::vector<uint8_t>& signature, const ScanLimits& limits,
+                   FileResultFn onDone) {
+    const uint64_t size = item.size;
+    auto started = std::chrono::steady_clock::now();
+    int fd = openForScan(item.path, &limits);
+    int error = fd < 0 ? errno : 0;
+    int elfClass = fd >= 0 ? readElfClass(fd, &limits, &error) : -1;
+    if (elfClass < 0) {
+        if (fd >= 0) ::close(fd);
+        FileResult result(item.path);
+        result.size = size;
+        result.inode = item.inode;
+        result.setError(error);
+        result.phases = limits.phases.get();
+        result.setElapsed(started);
+        onDone(result);
+        if (group) group->addFile(size);
+        return;
+    }
+
+    auto scan = std::make_shared<SplitScan>();
+    scan->fd = fd;
+    scan->path = item.path;
+    scan->size = size;
+    scan->inode = item.inode;
+    scan->elfClass = elfClass;
+    scan->started = started;
+    scan->instruments = limits;
+    scan->group = group;
+    scan->onDone = std::move(onDone);
+
+    const uint64_t scanned = std::min(size, limits.maxBytes);
+    if (scanned < size) scan->noteStop(StopReason::ByteBudget);
+
+    const size_t ranges = static_cast<size_t>((scanned + SPLIT_RANGE - 1) / SPLIT_RANGE);
+    for (size_t r = 0; r < ranges; ++r) scan->rangeTokens.emplace_back(limits.token);
+    scan->remaining = std::max<size_t>(ranges, 1);
+    if (ranges == 0) scan->finishRange(0);
+
+    const auto deadline = limits.deadline;
+    const Priority priority = limits.priority;
+    ThreadPool* yieldPool = limits.pool;
+    for (size_t r = 0; r < ranges; ++r) {
+        uint64_t begin = r * SPLIT_RANGE;
+        uint64_t end = std::min(scanned, begin + SPLIT_RANGE);
+        pool.submit([scan, r, begin, end, deadline, priority, yieldPool, &signature]() {
+            const ScanLimits& instruments = scan->instruments;
+            ScanLimits rangeLimits;
+            rangeLimits.token = &scan->rangeTokens[r];
+            rangeLimits.deadline = deadline;
+            rangeLimits.pool = yieldPool;
+            rangeLimits.priority = priority;
+            rangeLimits.metrics = instruments.metrics;
+            rangeLimits.trace = instruments.trace;
+            rangeLimits.fileId = instruments.fileId;
+            rangeLimits.live = instruments.live;
+            rangeLimits.file = &scan->path;
+            rangeLimits.perf = instruments.perf;
+            rangeLimits.engine = Engine::Split;
+            rangeLimits.fileSize = scan->size;
+            rangeLimits.phases = instruments.phases;
+            int64_t hit = findSignatureInRange(scan->fd, begin, end, signature, &rangeLimits);
+            scan->bytesRead.fetch_add(rangeLimits.bytesRead);
+
+            if (hit >= 0) {
+                scan->noteHit(hit);
+            } else if (rangeLimits.stopped != StopReason::None &&
+                       static_cast<int64_t>(begin) <= scan->firstHit.load()) {
+                // Stopped by the scan-wide token or a budget, not by a sibling hit.
+                scan->noteStop(rangeLimits.stopped);
+            } else if (rangeLimits.error) {
+                scan->error.store(rangeLimits.error);
+                scan->noteStop(StopReason::Unreadable);
+            }
+            scan->finishRange(rangeLimits.stopped == StopReason::None ? end - begin
+                                                                      : rangeLimits.bytesRead);
+        }, group, priority);
+    }
+}
+
+// One stat: true for regular files (symlinks followed), with their size.
+bool regularFileSize(const fs::path& path, uint64_t& size, uint64_t* inode = nullptr,
+                     uint64_t* dev = nullptr) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    size = static_cast<uint64_t>(st.st_size);
+    if (inode) *inode = static_cast<uint64_t>(st.st_ino);
+    if (dev) *dev = static_cast<uint64_t>(st.st_dev);
+    return true;
+}
+
+// ------------------------- Small-File Batching -------------------------
+//
+// Most files in a typical tree are a few KiB and not ELF, so a task per file
+// costs more in scheduling than the scan itself. The walker collects files
+// under SMALL_FILE into batches of --batch files, in walk order so a batch
+// mostly stays within one directory, and one task scans the whole batch
+// with a single open/read/close per file into a reused buffer. Files under
+// 4 bytes cannot hold the ELF magic and are never opened.
+
+constexpr uint64_t SMALL_FILE = 4096;
+constexpr uint64_t ELF_MAGIC_SIZE = 4;
+
+// Like scanFile() for a file expected to fit in `capacity` bytes: one read
+// into `buffer`. One that has grown since the walk gets the chunked scan.
+void scanSmallFile(const fs::path& path, const std::vector<uint8_t>& signature, uint8_t* buffer,
+                   size_t capacity, ScanLimits& limits, FileResult& result) {
+    result.phases = limits.phases.get();
+    int fd = openForScan(path, &limits);
+    if (fd < 0) {
+        result.setError(errno);
+        return;
+    }
+    FdCloser closer{fd};
+
+    size_t n;
+    {
+        PhaseTimer timer(&limits, Phase::Read);
+        n = preadFull(fd, buffer, capacity, 0, &limits.error);
+    }
+    result.setElfClass(elfClassOf(buffer, n));
+    if (result.elf) {
+        if (n == capacity) {
+            result.hit = findSignatureFd(fd, signature, &limits);
+        } else if (!signature.empty()) {
+            PhaseTimer timer(&limits, Phase::Match, n);
+            const uint8_t* it = std::search(buffer, buffer + n, signature.begin(), signature.end());
+            if (it != buffer + n) result.hit = it - buffer;
+            limits.bytesRead += n;
+        }
+    }
+    result.reason = result.hit >= 0 ? StopReason::None : limits.stopped;
+    result.bytesRead = limits.bytesRead;
+    result.setError(limits.error);
+}
+
+// ------------------------- Size-Aware Dispatch -------------------------
+//
+// Submitting in traversal order lets a huge file found last serialize the end
+// of the scan on one worker. Files pass through a bounded lookahead window
+// instead: once it is full, the largest file in it is dispatched together
+// with the smallest one, so long jobs start early while small files keep
+// flowing and the window keeps holding candidates worth ordering. At the end
+// the rest goes out largest first, which approximates longest-processing-
+// time-first scheduling without the full list up front.
+
+class SizeScheduler {
+public:
+    SizeScheduler(size_t windowSize, std::function<void(ScanItem&&)> dispatch)
+        : limit(windowSize), dispatch(std::move(dispatch)) {}
+
+    void push(ScanItem item);
+    void flush();
+
+private:
+    size_t limit;
+    std::function<void(ScanItem&&)> dispatch;
+    std::multimap<uint64_t, ScanItem> window;
+
+    void emit(std::multimap<uint64_t, ScanItem>::iterator it);
+};
+
+void SizeScheduler::push(ScanItem item) {
+    if (limit <= 1) {
+        dispatch(std::move(item));
+        return;
+    }
+
+    const uint64_t size = item.size;
+    window.emplace(size, std::move(item));
+    if (window.size() < limit) return;
+
+    emit(std::prev(window.end()));
+    emit(window.begin());
+}
+
+void SizeScheduler::flush() {
+    while (!window.empty())
+        emit(std::prev(window.end()));
+}
+
+void SizeScheduler::emit(std::multimap<uint64_t, ScanItem>::iterator it) {
+    ScanItem item = std::move(it->second);
+    window.erase(it);
+    dispatch(std::move(item));
+}
+
+// ------------------------- Adaptive Concurrency -------------------------
+//
+// The core count says little about how many files should be read at once:
+// network storage wants many more reads in flight, a single spinning disk
+// fewer. With --adaptive the pool gets --max-inflight threads and the
+// dispatcher admits a file only while fewer than limit() are in flight.
+//
+// Every interval the controller scores throughput as bytes/s plus a fixed
+// cost per file, so a tree of tiny files is not mistaken for an idle one,
+// and hill-climbs one knob per interval, alternating between the in-flight
+// limit (additive increase, multiplicative decrease) and the read size used
+// by each scan. A step that raises the score keeps its direction; a flat or
+// worse result flips it, and a worse one is undone first. The knobs then
+// oscillate around the knee of whatever storage is underneath.
+
+class ConcurrencyController {
+public:
+    static constexpr size_t MIN_READ = 64 << 10;
+    static constexpr size_t MAX_READ = 4 << 20;
+
+    // `cancelled` is polled while admit() waits.
+    ConcurrencyController(TaskGroup& group, size_t minInFlight, size_t maxInFlight,
+                          size_t initialInFlight, std::function<bool()> cancelled);
+
+    // Dispatcher thread only. Blocks until fewer than limit() of the
+    // `dispatched` files are unfinished, tuning the knobs meanwhile.
+    // Returns at once when cancelled: queued files will not need a slot.
+    void admit(uint64_t dispatched);
+    // Dispatcher thread only; evaluates at most once per interval.
+    void sample();
+
+    size_t limit() const { return inFlight; }
+    size_t readSize() const { return readBytes.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr auto INTERVAL = std::chrono::milliseconds(250);
+    static constexpr auto MAX_INTERVAL = std::chrono::seconds(2);
+    static constexpr uint64_t FILE_COST = 64 << 10;     // bytes a file's open+stat is worth
+    static constexpr double TOLERANCE = 0.05;           // smaller changes are noise
+
+    enum Knob { InFlight = 0, ReadSize = 1 };
+
+    TaskGroup& group;
+    std::function<bool()> cancelled;
+    size_t minInFlight, maxInFlight;
+    size_t inFlight;
+    std::atomic<size_t> readBytes{256 << 10};           // read by pool workers
+
+    std::chrono::steady_clock::time_point intervalStart;
+    uint64_t filesAtStart = 0, bytesAtStart = 0;
+    double lastScore = -1;
+    Knob knob = InFlight;           // knob changed before the current interval
+    int direction[2] = {+1, +1};
+    size_t before = 0;              // its value before that change
+
+    size_t step(Knob k, int dir) const;
+    void set(Knob k, size_t value);
+    size_t get(Knob k) const { return k == InFlight ? inFlight : readSize(); }
+};
+
+ConcurrencyController::ConcurrencyController(TaskGroup& group, size_t minInFlight,
+                                             size_t maxInFlight, size_t initialInFlight,
+                                             std::function<bool()> cancelled)
+    : group(group),
+      cancelled(std::move(cancelled)),
+      minInFlight(std::max<size_t>(1, minInFlight)),
+      maxInFlight(std::max(this->minInFlight, maxInFlight)),
+      inFlight(std::clamp(initialInFlight, this->minInFlight, this->maxInFlight)),
+      intervalStart(std::chrono::steady_clock::now()),
+      before(inFlight) {}
+
+void ConcurrencyController::admit(uint64_t dispatched) {
+    while (!cancelled()) {
+        sample();
+        if (dispatched < inFlight) return;
+        if (group.waitForFiles(dispatched - inFlight + 1, std::chrono::milliseconds(50))) return;
+    }
+}
+
+size_t ConcurrencyController::step(Knob k, int dir) const {
+    if (k == InFlight) {
+        size_t next = dir > 0 ? inFlight + std::max<size_t>(1, inFlight / 8) : inFlight * 3 / 4;
+        return std::clamp(next, minInFlight, maxInFlight);
+    }
+    size_t next = dir > 0 ? readSize() * 2 : readSize() / 2;
+    return std::clamp(next, MIN_READ, MAX_READ);
+}
+
+void ConcurrencyController::set(Knob k, size_t value) {
+    if (k == InFlight) inFlight = value;
+    else readBytes.store(value, std::memory_order_relaxed);
+}
+
+void ConcurrencyController::sample() {
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = now - intervalStart;
+    if (elapsed < INTERVAL) return;
+
+    TaskGroup::Progress p = group.progress();
+    uint64_t files = p.filesDone - filesAtStart;
+    // Nothing finished yet (a few huge files): keep measuring a while.
+    if (files == 0 && elapsed < MAX_INTERVAL) return;
+
+    double secs = std::chrono::duration<double>(elapsed).count();
+    double score = (p.bytesDone - bytesAtStart + files * FILE_COST) / secs;
+    intervalStart = now;
+    filesAtStart = p.filesDone;
+    bytesAtStart = p.bytesDone;
+
+    if (lastScore >= 0 && score <= lastScore * (1 + TOLERANCE)) {
+        if (score < lastScore * (1 - TOLERANCE)) {
+            // Worse: undo, and back off further when the step was an increase.
+            set(knob, before);
+            if (knob == InFlight && direction[knob] > 0) set(knob, step(knob, -1));
+        }
+        direction[knob] = -direction[knob];
+    }
+    lastScore = score;
+
+    // Probe the other knob; flip at a bound instead of standing still.
+    knob = knob == InFlight ? ReadSize : InFlight;
+    before = get(knob);
+    size_t next = step(knob, direction[knob]);
+    if (next == before) {
+        direction[knob] = -direction[knob];
+        next = step(knob, direction[knob]);
+    }
+    set(knob, next);
+}
+
+// ------------------------- Staged Pipeline -------------------------
+//
+// With --pipeline the sweep does not run one task per file. Files flow
+// through four stages, each with its own bounded queue and worker threads:
+//
+//   open   - open, ELF magic check
+//   read   - reads the file in chunks, each starting signature.size()-1 bytes
+//            before its own range so chunks can be matched independently
+//   match  - searches a chunk; the first hit stops the file's reader
+//   report - prints results and updates counters (one thread)
+//
+// A full queue blocks the stage feeding it, so a slow disk backs up into the
+// walker instead of piling up buffers, and a busy matcher slows the readers
+// down. Chunk buffers are recycled through a free list. Time a worker spends
+// blocked on the next stage's full queue is reported apart from busy time.
+
+// Blocked-time counter of the stage the current thread works for.
+thread_local std::atomic<uint64_t>* stageBlockedNs = nullptr;
+
+template <typename T>
+class Stage {
+public:
+    struct Stats {
+        const char* name;
+        size_t depth;
+        size_t workers;
+        uint64_t busyNs;            // summed over workers, includes blockedNs
+        uint64_t blockedNs;         // waiting for room downstream
+    };
+
+    Stage(const char* name, size_t workers, size_t capacity, std::function<void(T&)> handler)
+        : name(name), capacity(std::max<size_t>(1, capacity)), handler(std::move(handler)) {
+        for (size_t i = 0; i < std::max<size_t>(1, workers); ++i)
+            threads.emplace_back([this]() { workerLoop(); });
+    }
+    ~Stage() { finish(); }
+
+    // Blocks while the queue is full.
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (queue.size() >= capacity) {
+            auto start = std::chrono::steady_clock::now();
+            notFull.wait(lock, [this]() { return queue.size() < capacity; });
+            if (stageBlockedNs)
+                stageBlockedNs->fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                              std::chrono::steady_clock::now() - start).count(),
+                                          std::memory_order_relaxed);
+        }
+        queue.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    // No more input: workers drain the queue and exit.
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        notEmpty.notify_all();
+        for (auto& t : threads)
+            if (t.joinable()) t.join();
+    }
+
+    Stats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {name, queue.size(), threads.size(), busyNs.load(std::memory_order_relaxed),
+                blockedNs.load(std::memory_order_relaxed)};
+    }
+
+private:
+    const char* name;
+    size_t capacity;
+    std::function<void(T&)> handler;
+    std::deque<T> queue;
+    std::mutex mutex;
+    std::condition_variable notEmpty, notFull;
+    bool closed = false;
+    std::atomic<uint64_t> busyNs{0};
+    std::atomic<uint64_t> blockedNs{0};
+    std::vector<std::thread> threads;
+
+    void workerLoop() {
+        stageBlockedNs = &blockedNs;
+        while (true) {
+            T item;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                notEmpty.wait(lock, [this]() { return closed || !queue.empty(); });
+                if (queue.empty()) return;
+                item = std::move(queue.front());
+                queue.pop_front();
+                notFull.notify_one();
+            }
+            auto start = std::chrono::steady_clock::now();
+            handler(item);
+            busyNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::steady_clock::now() - start).count(),
+                             std::memory_order_relaxed);
+        }
+    }
+};
+
+class ScanPipeline {
+public:
+    struct Workers {
+        size_t open = 2;
+        size_t read = 0;        // 0 = one per core
+        size_t match = 0;       // 0 = one per core
+    };
+
+    ScanPipeline(const std::vector<uint8_t>& signature, Workers workers, FileResultFn onDone);
+    ~ScanPipeline() { finish(); }
+
+    // Blocks while the open stage is full.
+    void submit(const ScanItem& item, const ScanLimits& limits);
+
+    // Waits until every submitted file is reported, calling onProgress at
+    // `interval`, then stops the stages.
+    template <typename Callback>
+    void wait(Callback&& onProgress, std::chrono::milliseconds interval);
+    void finish();
+
+    // Counts a file that needed no scan.
+    void skip(uint64_t bytes) {
+        submitted.fetch_add(1);
+        bytesDone.fetch_add(bytes);
+        std::lock_guard<std::mutex> lock(reportMutex);
+        reported.fetch_add(1);
+    }
+
+    TaskGroup::Progress progress() const;
+    // One line: queue depth and utilization of each stage since start.
+    std::string stageSummary();
+    // Queued items in the open, read, match and report stages.
+    void stageDepths(uint64_t depths[4]) {
+        depths[0] = openStage.stats().depth;
+        depths[1] = readStage.stats().depth;
+        depths[2] = matchStage.stats().depth;
+        depths[3] = reportStage.stats().depth;
+    }
+
+private:
+    struct FileJob {
+        fs::path path;
+        uint64_t size = 0, inode = 0;
+        int fd = -1;
+        int elfClass = -1;
+        ScanLimits limits;                  // .error: errno of a failed open or read
+        std::chrono::steady_clock::time_point queued, opened;
+        std::atomic<int64_t> hit{-1};
+        std::atomic<size_t> pending{1};     // chunks in flight + the reader
+        std::atomic<uint64_t> bytesRead{0};
+
+        ~FileJob() {
+            if (fd >= 0) ::close(fd);
+        }
+    };
+    using Job = std::shared_ptr<FileJob>;
+
+    struct Chunk {
+        Job job;
+        std::vector<uint8_t> data;
+        uint64_t offset = 0;                // file offset of data[0]
+        size_t length = 0;
+    };
+
+    static constexpr size_t QUEUE_DEPTH = 64;
+    static constexpr size_t DEFAULT_CHUNK = 256 << 10;
+
+    const std::vector<uint8_t>& signature;
+    FileResultFn onDone;
+    const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+    std::atomic<uint64_t> submitted{0}, reported{0}, bytesDone{0};
+    std::mutex reportMutex;
+    std::condition_variable reportCv;
+
+    std::mutex freeMutex;
+    std::vector<std::vector<uint8_t>> freeBuffers;
+
+    // Declared downstream first so they are destroyed (drained) last.
+    Stage<Job> reportStage;
+    Stage<Chunk> matchStage;
+    Stage<Job> readStage;
+    Stage<Job> openStage;
+
+    void openFile(Job& job);
+    void readFile(Job& job);
+    void matchChunk(Chunk& chunk);
+    void report(Job& job);
+    void release(const Job& job);
+};
+
+ScanPipeline::ScanPipeline(const std::vector<uint8_t>& signature, Workers workers,
+                           FileResultFn onDone)
+    : signature(signature),
+      onDone(std::move(onDone)),
+      reportStage("report", 1, QUEUE_DEPTH, [this](Job& job) { report(job); }),
+      matchStage("match", workers.match ? workers.match : hardwareThreads(), QUEUE_DEPTH,
+                 [this](Chunk& chunk) { matchChunk(chunk); }),
+      readStage("read", workers.read ? workers.read : hardwareThreads(), QUEUE_DEPTH,
+                [this](Job& job) { readFile(job); }),
+      openStage("open", workers.open, QUEUE_DEPTH, [this](Job& job) { openFile(job); }) {}
+
+void ScanPipeline::submit(const ScanItem& item, const ScanLimits& limits) {
+    auto job = std::make_shared<FileJob>();
+    job->path = item.path;
+    job->size = item.size;
+    job->inode = item.inode;
+    job->limits = limits;
+    job->limits.file = &job->path;
+    job->limits.engine = Engine::Pipeline;
+    job->queued = std::chrono::steady_clock::now();
+    submitted.fetch_add(1);
+    openStage.push(std::move(job));
+}
+
+template <typename Callback>
+void ScanPipeline::wait(Callback&& onProgress, std::chrono::milliseconds interval) {
+    std::unique_lock<std::mutex> lock(reportMutex);
+    while (!reportCv.wait_for(lock, interval, [this]() { return reported == submitted; })) {
+        lock.unlock();
+        onProgress(progress());
+        lock.lock();
+    }
+    lock.unlock();
+    finish();
+}
+
+void ScanPipeline::finish() {
+    openStage.finish();
+    readStage.finish();
+    matchStage.finish();
+    reportStage.finish();
+}
+
+TaskGroup::Progress ScanPipeline::progress() const {
+    uint64_t done = reported.load();
+    uint64_t inFlight = submitted.load() - done;
+    return {inFlight, inFlight, done, bytesDone.load()};
+}
+
+void ScanPipeline::openFile(Job& job) {
+    if (job->limits.token && job->limits.token->cancelled()) {
+        job->limits.stopped = StopReason::Cancelled;
+    } else if (!signature.empty()) {
+        // The per-file deadline starts when the file is opened, not queued.
+        auto& deadline = job->limits.deadline;
+        job->opened = std::chrono::steady_clock::now();
+        if (deadline != std::chrono::steady_clock::time_point::max())
+            deadline += job->opened - job->queued;
+        job->fd = openForScan(job->path, &job->limits);
+        if (job->fd < 0) job->limits.error = errno;
+        else job->elfClass = readElfClass(job->fd, &job->limits, &job->limits.error);
+        if (job->elfClass >= 0) {
+            readStage.push(std::move(job));
+            return;
+        }
+    }
+    release(job);
+}
+
+void ScanPipeline::readFile(Job& job) {
+    const size_t overlap = signature.size() - 1;
+    const size_t chunkSize = std::max({MIN_BUFFER_SIZE, signature.size() + EXTRA_BUFFER,
+                                       job->limits.readSize ? job->limits.readSize : DEFAULT_CHUNK});
+    ScanLimits& limits = job->limits;
+
+    for (uint64_t offset = 0; job->hit.load(std::memory_order_relaxed) < 0; offset += chunkSize) {
+        if (limits.token && limits.token->cancelled())
+            limits.stopped = StopReason::Cancelled;
+        else if (offset > 0 && std::chrono::steady_clock::now() > limits.deadline)
+            limits.stopped = StopReason::Deadline;
+        else if (offset >= limits.maxBytes)
+            limits.stopped = StopReason::ByteBudget;
+        if (limits.stopped != StopReason::None) break;
+
+        // Re-read the tail of the previous chunk so a match across the
+        // boundary is seen by this one.
+        const size_t carried = static_cast<size_t>(std::min<uint64_t>(offset, overlap));
+        Chunk chunk;
+        {
+            std::lock_guard<std::mutex> lock(freeMutex);
+            if (!freeBuffers.empty()) {
+                chunk.data = std::move(freeBuffers.back());
+                freeBuffers.pop_back();
+            }
+        }
+        chunk.data.resize(carried + chunkSize);
+        chunk.offset = offset - carried;
+        {
+            PhaseTimer timer(&limits, Phase::Read);
+            chunk.length = preadFull(job->fd, chunk.data.data(), carried + chunkSize,
+                                     static_cast<off_t>(chunk.offset), &limits.error);
+        }
+        if (chunk.length <= carried) break;
+
+        job->bytesRead.fetch_add(chunk.length - carried, std::memory_order_relaxed);
+        const bool last = chunk.length < carried + chunkSize;
+        chunk.job = job;
+        job->pending.fetch_add(1);
+        matchStage.push(std::move(chunk));
+        if (last) break;
+    }
+    release(job);
+}
+
+void ScanPipeline::matchChunk(Chunk& chunk) {
+    const Job& job = chunk.job;
+    if (job->hit.load(std::memory_order_relaxed) < 0) {
+        PhaseTimer timer(&job->limits, Phase::Match, chunk.length);
+        const uint8_t* first = chunk.data.data();
+        const uint8_t* last = first + chunk.length;
+        const uint8_t* it = std::search(first, last, signature.begin(), signature.end());
+        if (it != last) {
+            int64_t offset = static_cast<int64_t>(chunk.offset + (it - first));
+            int64_t seen = -1;
+            while ((seen < 0 || offset < seen) &&
+                   !job->hit.compare_exchange_weak(seen, offset)) {}
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(freeMutex);
+        freeBuffers.push_back(std::move(chunk.data));
+    }
+    Job done = std::move(chunk.job);
+    release(done);
+}
+
+// Drops one reference; the last one hands the file to the report stage.
+void ScanPipeline::release(const Job& job) {
+    if (job->pending.fetch_sub(1) == 1) reportStage.push(job);
+}
+
+void ScanPipeline::report(Job& job) {
+    int64_t hit = job->hit.load();
+    // A hit makes the file infected even if the reader stopped early.
+    FileResult result(job->path, hit, hit >= 0 ? StopReason::None : job->limits.stopped);
+    result.size = job->size;
+    result.inode = job->inode;
+    result.setElfClass(job->elfClass);
+    result.bytesRead = job->bytesRead.load();
+    result.setError(job->limits.error);
+    result.phases = job->limits.phases.get();
+    if (job->fd >= 0) result.setElapsed(job->opened);
+    onDone(result);
+    // Same accounting as the pool: whole size unless stopped early.
+    bytesDone.fetch_add(hit < 0 && job->limits.stopped != StopReason::None ? job->bytesRead.load()
+                                                                         : job->size);
+    if (job->fd >= 0) ::close(job->fd);
+    job->fd = -1;
+    job.reset();
+
+    std::lock_guard<std::mutex> lock(reportMutex);
+    reported.fetch_add(1);
+    reportCv.notify_all();
+}
+
+std::string ScanPipeline::stageSummary() {
+    const double elapsedNs = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - started).count();
+    std::ostringstream line;
+    line << "Stages:";
+    const char* sep = " ";
+    auto add = [&](auto&& stats) {
+        double total = elapsedNs * stats.workers;
+        double busy = total > 0 ? 100.0 * (stats.busyNs - stats.blockedNs) / total : 0;
+        double blocked = total > 0 ? 100.0 * stats.blockedNs / total : 0;
+        line << sep << stats.name << " " << stats.depth << " queued/" << stats.workers
+             << (stats.workers == 1 ? " thread " : " threads ") << std::fixed
+             << std::setprecision(0) << busy << "% busy";
+        if (blocked >= 1) line << " " << blocked << "% blocked";
+        sep = ", ";
+    };
+    add(openStage.stats());
+    add(readStage.stats());
+    add(matchStage.stats());
+    add(reportStage.stats());
+    return line.str();
+}
+
+#ifdef CRYPTY_COROUTINES
+// ------------------------- Coroutine Core -------------------------
+//
+// With --coroutines every file scan is a coroutine that co_awaits its open
+// and reads. Those are offloaded to a separate set of I/O threads, and each
+// completion resumes the coroutine on the CPU executor (the scan pool). A
+// suspended scan costs a heap frame plus its window instead of a blocked
+// thread, so thousands of files can be in flight on a few threads. Matching
+// goes through the same ChunkMatcher as the blocking scanners. The backend
+// is thread offload; io_uring would fit behind the same awaitable but needs
+// a library this build does not depend on.
+
+// Fire-and-forget coroutine: starts suspended, frees its frame when done.
+struct ScanCoroutine {
+    struct promise_type {
+        ScanCoroutine get_return_object() {
+            return {std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }   // scans catch their own
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+class CoroutineCore {
+public:
+    CoroutineCore(Executor& cpu, size_t ioThreads, size_t maxInFlight, TaskGroup& group,
+                  const std::vector<uint8_t>& signature, FileResultFn onDone)
+        : cpu(cpu), io(ioThreads), maxInFlight(std::max<size_t>(1, maxInFlight)), group(group),
+          signature(signature), onDone(std::move(onDone)) {}
+
+    // Starts a scan; blocks while maxInFlight scans are running.
+    void scan(const ScanItem& item, const ScanLimits& limits);
+
+private:
+    // Awaitable that runs `op` on an I/O thread and resumes the awaiting
+    // coroutine on the CPU executor with its result.
+    template <typename Op>
+    struct Offload {
+        CoroutineCore& core;
+        Op op;
+        decltype(op()) result{};
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            core.io.post([this, h]() {
+                result = op();
+                core.cpu.post([h]() { h.resume(); }, &core.group);
+            }, &core.group);
+        }
+        decltype(op()) await_resume() { return result; }
+    };
+    template <typename Op>
+    Offload<Op> offload(Op op) { return {*this, std::move(op), {}}; }
+
+    Executor& cpu;
+    ThreadPool io;
+    const size_t maxInFlight;
+    TaskGroup& group;
+    const std::vector<uint8_t>& signature;
+    FileResultFn onDone;
+
+    static constexpr size_t READ_SIZE = 128 << 10;
+
+    std::mutex mutex;
+    std::condition_variable slotFree;
+    size_t inFlight = 0;
+
+    ScanCoroutine run(ScanItem item, ScanLimits limits);
+};
+
+void CoroutineCore::scan(const ScanItem& item, const ScanLimits& limits) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        slotFree.wait(lock, [this]() { return inFlight < maxInFlight; });
+        ++inFlight;
+    }
+    std::coroutine_handle<> h = run(item, limits).handle;
+    cpu.post([h]() { h.resume(); }, &group);
+}
+
+ScanCoroutine CoroutineCore::run(ScanItem item, ScanLimits limits) {
+    const fs::path& path = item.path;
+    limits.file = &path;
+    limits.engine = Engine::Coroutine;
+    FileResult result(path);
+    result.size = item.size;
+    result.inode = item.inode;
+    auto started = std::chrono::steady_clock::now();
+    int64_t hit = -1;
+    try {
+        // Open and ELF class in one hop; fd -1 for unreadable or not ELF.
+        // The frame, and `limits` in it, outlives every offloaded call.
+        const ScanLimits* instruments = &limits;
+        auto [fd, elfClass, error] = co_await offload([&path, instruments]() {
+            int fd = openForScan(path, instruments);
+            int error = fd < 0 ? errno : 0;
+            int cls = fd >= 0 ? readElfClass(fd, instruments, &error) : -1;
+            if (fd >= 0 && cls < 0) {
+                ::close(fd);
+                fd = -1;
+            }
+            return std::make_tuple(fd, cls, error);
+        });
+        result.setElfClass(elfClass);
+        result.phases = limits.phases.get();
+        limits.error = error;
+        FdCloser closer{fd};
+        if (fd >= 0) {
+            // Every read is a round trip between threads; make it count.
+            if (limits.readSize == 0) limits.readSize = READ_SIZE;
+            ChunkMatcher matcher(signature, &limits);
+            std::vector<uint8_t> window(matcher.windowSize());
+            off_t offset = 0;
+            while (matcher.proceed()) {
+                uint8_t* dst = matcher.readTarget(window.data());
+                size_t want = matcher.chunkSize();
+                int* readError = &limits.error;
+                size_t got = co_await offload([fd, dst, want, offset, instruments, readError]() {
+                    PhaseTimer timer(instruments, Phase::Read);
+                    return preadFull(fd, dst, want, offset, readError);
+                });
+                offset += static_cast<off_t>(got);
+                if (!matcher.consume(window.data(), got)) break;
+            }
+            hit = matcher.result();
+        }
+        result.hit = hit;
+        result.reason = hit >= 0 ? StopReason::None : limits.stopped;
+        result.bytesRead = limits.bytesRead;
+        result.setError(limits.error);
+    } catch (const std::exception& e) {
+        std::cerr << "Error scanning " << path << ": " << e.what() << "\n";
+        result.setError(scanFailureError());
+    }
+    result.setElapsed(started);
+    onDone(result);
+    // Stopped early: count what was read, not the whole file.
+    group.addFile(hit < 0 && limits.stopped != StopReason::None ? limits.bytesRead : item.size);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    --inFlight;
+    slotFree.notify_one();
+}
+#endif
+
+// ------------------------- Directory State -------------------------
+//
+// With --state, every directory visited is recorded together with its own
+// metadata (dev/ino/mtime/ctime), a digest of its files' names and metadata,
+// and the hits found in it. On the next run every directory is still listed
+// and every entry stat'ed, but a directory whose stamp and file digest are
+// both unchanged has none of its files opened or scanned; the hits recorded
+// for it are replayed. A cold tree therefore costs one stat per file instead
+// of one open and read.
+//
+// Adding, removing or renaming an entry changes the directory's own stamp; a
+// file rewritten in place changes its own mtime/ctime and so the digest.
+// Either way the whole directory is scanned again.
+
+struct DirStamp {
+    uint64_t dev = 0, ino = 0, mtime_ns = 0, ctime_ns = 0, size = 0;
+
+    bool operator==(const DirStamp& o) const {
+        return dev == o.dev && ino == o.ino && mtime_ns == o.mtime_ns &&
+               ctime_ns == o.ctime_ns && size == o.size;
+    }
+};
+
+struct DirRecord {
+    DirStamp stamp;
+    uint64_t filesDigest = 0;               // names and stamps of its files, by name
+    std::vector<std::string> subdirs;
+    std::vector<std::string> infected;
+};
+
+constexpr uint64_t FNV_OFFSET = 1469598103934665603ULL;
+constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+uint64_t fnv1a(uint64_t h, const void* data, size_t len) {
+    const auto* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+// Fills stamp from lstat (directories) or stat (files); false on failure.
+bool statStamp(const fs::path& path, DirStamp& stamp, bool follow, mode_t* mode = nullptr) {
+    struct stat st;
+    if ((follow ? ::stat(path.c_str(), &st) : ::lstat(path.c_str(), &st)) != 0)
+        return false;
+    if (mode) *mode = st.st_mode;
+
+    stamp.dev = static_cast<uint64_t>(st.st_dev);
+    stamp.ino = static_cast<uint64_t>(st.st_ino);
+    stamp.mtime_ns = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ULL + st.st_mtim.tv_nsec;
+    stamp.ctime_ns = static_cast<uint64_t>(st.st_ctim.tv_sec) * 1000000000ULL + st.st_ctim.tv_nsec;
+    // Directory sizes are not meaningful on every filesystem; files use it.
+    stamp.size = S_ISDIR(st.st_mode) ? 0 : static_cast<uint64_t>(st.st_size);
+    return true;
+}
+
+class DirectoryState {
+public:
+    explicit DirectoryState(uint64_t signatureDigest) : sigDigest(signatureDigest) {}
+
+    // Missing, unreadable or foreign state files simply yield a full scan.
+    void load(const std::string& path);
+    void save(const std::string& path) const;
+
+    // Walks root, appending files that need scanning to `files` and hits
+    // replayed from unchanged directories to `replayed`.
+    // With `metrics`, each directory entry listed and stat'ed is one walk step.
+    void walk(const fs::path& root, std::vector<ScanItem>& files,
+              std::vector<fs::path>& replayed, ScanMetrics* metrics = nullptr);
+
+    // Records a hit found during this run so it can be replayed later.
+    void addInfected(const fs::path& file);
+
+    size_t directoriesSeen() const { return next.size(); }
+    size_t directoriesPruned() const { return pruned; }
+    size_t subtreesUnchanged() const { return unchanged; }
+
+private:
+    uint64_t sigDigest;
+    std::map<std::string, DirRecord> previous;
+    std::map<std::string, DirRecord> next;
+    size_t pruned = 0;
+    size_t unchanged = 0;
+    ScanMetrics* metrics = nullptr;
+
+    // True when dir and every directory below it were pruned.
+    bool walkDirectory(const fs::path& dir, std::vector<ScanItem>& files,
+                       std::vector<fs::path>& replayed);
+};
+
+void DirectoryState::load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) return;
+
+    std::string line, magic;
+    uint64_t version = 0, digest = 0;
+    if (!std::getline(in, line)) return;
+    std::istringstream header(line);
+    header >> magic >> version >> std::hex >> digest;
+    if (magic != "crypty-state" || version != 3 || digest != sigDigest) return;
+
+    DirRecord* current = nullptr;
+    while (std::getline(in, line)) {
+        if (line.size() < 2 || line[1] != ' ') continue;
+        std::string rest = line.substr(2);
+
+        if (line[0] == 'D') {
+            std::istringstream iss(rest);
+            DirRecord rec;
+            iss >> rec.stamp.dev >> rec.stamp.ino >> rec.stamp.mtime_ns >> rec.stamp.ctime_ns >>
+                std::hex >> rec.filesDigest >> std::dec;
+            if (!iss || iss.get() != ' ') { current = nullptr; continue; }
+            std::string dir;
+            std::getline(iss, dir);
+            current = &(previous[dir] = std::move(rec));
+        } else if (current && line[0] == 'S') {
+            current->subdirs.push_back(rest);
+        } else if (current && line[0] == 'I') {
+            current->infected.push_back(rest);
+        }
+    }
+}
+
+void DirectoryState::save(const std::string& path) const {
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) throw std::runtime_error("Cannot write state file: " + tmp);
+
+        out << "crypty-state 3 " << std::hex << sigDigest << std::dec << "\n";
+        for (const auto& [dir, rec] : next) {
+            // Line-oriented format: names with newlines are left out and
+            // simply rescanned next time.
+            if (dir.find('\n') != std::string::npos) continue;
+            out << "D " << rec.stamp.dev << ' ' << rec.stamp.ino << ' '
+                << rec.stamp.mtime_ns << ' ' << rec.stamp.ctime_ns << ' ' << std::hex
+                << rec.filesDigest << std::dec << ' ' << dir << "\n";
+            for (const auto& name : rec.subdirs) out << "S " << name << "\n";
+            for (const auto& name : rec.infected) out << "I " << name << "\n";
+        }
+        if (!out) throw std::runtime_error("Cannot write state file: " + tmp);
+    }
+    fs::rename(tmp, path);
+}
+
+void DirectoryState::walk(const fs::path& root, std::vector<ScanItem>& files,
+                          std::vector<fs::path>& replayed, ScanMetrics* metrics) {
+    this->metrics = metrics;
+    walkDirectory(root, files, replayed);
+}
+
+void DirectoryState::addInfected(const fs::path& file) {
+    auto it = next.find(file.parent_path().string());
+    if (it != next.end())
+        it->second.infected.push_back(file.filename().string());
+}
+
+bool DirectoryState::walkDirectory(const fs::path& dir, std::vector<ScanItem>& files,
+                                   std::vector<fs::path>& replayed) {
+    DirRecord rec;
+    if (!statStamp(dir, rec.stamp, false))
+        throw fs::filesystem_error("cannot stat directory", dir,
+                                   std::error_code(errno, std::generic_category()));
+
+    const std::string key = dir.string();
+    auto prev = previous.find(key);
+
+    // Files are stat'ed, not opened, to build the digest.
+    std::vector<std::pair<ScanItem, DirStamp>> children;
+    auto step = std::chrono::steady_clock::now();
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        DirStamp st;
+        mode_t mode = 0;
+        if (entry.is_directory() && !entry.is_symlink()) {
+            rec.subdirs.push_back(entry.path().filename().string());
+        } else if (statStamp(entry.path(), st, true, &mode) && S_ISREG(mode)) {
+            children.push_back({{entry.path(), st.size, st.ino, st.dev}, st});
+        }
+        if (metrics) {
+            metrics->record(Phase::Walk, step);
+            step = std::chrono::steady_clock::now();
+        }
+    }
+    std::sort(rec.subdirs.begin(), rec.subdirs.end());
+    std::sort(children.begin(), children.end(),
+              [](const auto& a, const auto& b) { return a.first.path < b.first.path; });
+    rec.filesDigest = FNV_OFFSET;
+    for (const auto& [item, st] : children) {
+        const std::string name = item.path.filename().string();
+        rec.filesDigest = fnv1a(rec.filesDigest, name.data(), name.size() + 1);
+        rec.filesDigest = fnv1a(rec.filesDigest, &st, sizeof(st));
+    }
+
+    const bool same = prev != previous.end() && prev->second.stamp == rec.stamp &&
+                      prev->second.filesDigest == rec.filesDigest;
+    if (same) {
+        rec.infected = prev->second.infected;
+        for (const auto& name : rec.infected)
+            replayed.push_back(dir / name);
+        ++pruned;
+    } else {
+        for (auto& child : children) files.push_back(std::move(child.first));
+    }
+
+    bool subtreeSame = same;
+    for (const auto& name : rec.subdirs)
+        subtreeSame = walkDirectory(dir / name, files, replayed) && subtreeSame;
+    if (subtreeSame) ++unchanged;
+
+    next[key] = std::move(rec);
+    return subtreeSame;
+}
+
+// ------------------------- On-Access Daemon -------------------------
+//
+// --on-access <mount> subscribes to fanotify FAN_OPEN_EXEC_PERM and
+// FAN_CLOSE_WRITE on each mount and scans the fd delivered with the event on
+// the resident pool; the path is looked up only for the report line.
+// Permission events are answered by whichever comes first: the scan (deny if
+// infected) or the latency budget (allow). When too many permission events
+// are in flight the daemon fails open and allows immediately.
+// Post-write scans are coalesced per inode: a file written again before its
+// scan has started is not queued twice. Above maxWrites queued scans, new
+// ones are dropped and counted.
+
+volatile std::sig_atomic_t g_terminate = 0;
+
+void onTerminate(int) { g_terminate = 1; }
+
+#ifdef __linux__
+
+std::string describeFd(int fd) {
+    char link[64];
+    char target[4096];
+    std::snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t n = ::readlink(link, target, sizeof(target) - 1);
+    if (n < 0) return "<fd " + std::to_string(fd) + ">";
+    return std::string(target, static_cast<size_t>(n));
+}
+
+class OnAccessScanner {
+public:
+    OnAccessScanner(const std::vector<uint8_t>& signature, ThreadPool& pool,
+                    std::chrono::milliseconds budget, size_t maxPending, size_t maxWrites);
+    ~OnAccessScanner();
+
+    void watch(const std::string& mount);
+    void run();
+    void printSummary() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        int fd;
+        Clock::time_point received;
+        std::atomic<bool> answered{false};
+
+        Event(int f, Clock::time_point t) : fd(f), received(t) {}
+        ~Event() { ::close(fd); }
+    };
+
+    const std::vector<uint8_t>& signature;
+    ThreadPool& pool;
+    std::chrono::milliseconds budget;
+    size_t maxPending;
+    size_t maxWrites;
+    int fanFd = -1;
+
+    // Permission events in arrival order; with one fixed budget this is also
+    // deadline order, so the front is always the next one to expire.
+    std::deque<std::shared_ptr<Event>> pending;
+    std::atomic<size_t> inFlight{0};
+
+    std::mutex writesMutex;
+    std::set<std::pair<dev_t, ino_t>> writesQueued;   // post-write scans not yet started
+
+    mutable std::mutex statsMutex;
+    std::mutex outputMutex;
+    std::vector<uint32_t> latenciesUs;      // ring of recent response latencies
+    size_t latencyCursor = 0;
+    std::atomic<uint64_t> scanned{0}, denied{0}, timedOut{0}, overloaded{0}, overflows{0};
+    std::atomic<uint64_t> writesDropped{0}, writesCoalesced{0};
+
+    void handle(const struct fanotify_event_metadata* meta);
+    void respond(Event& ev, bool allow);
+    void expire();
+};
+
+constexpr size_t LATENCY_SAMPLES = 1 << 16;
+
+OnAccessScanner::OnAccessScanner(const std::vector<uint8_t>& sig, ThreadPool& p,
+                                 std::chrono::milliseconds b, size_t maxP, size_t maxW)
+    : signature(sig), pool(p), budget(b), maxPending(maxP), maxWrites(maxW) {
+    fanFd = fanotify_init(FAN_CLASS_CONTENT | FAN_CLOEXEC | FAN_NONBLOCK,
+                          O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+    if (fanFd < 0)
+        throw std::runtime_error(std::string("fanotify_init failed: ") + std::strerror(errno));
+    latenciesUs.reserve(LATENCY_SAMPLES);
+}
+
+OnAccessScanner::~OnAccessScanner() {
+    // Never leave a process blocked on us: allow whatever is still pending.
+    for (auto& ev : pending) respond(*ev, true);
+    if (fanFd >= 0) ::close(fanFd);
+}
+
+void OnAccessScanner::watch(const std::string& mount) {
+    if (fanotify_mark(fanFd, FAN_MARK_ADD | FAN_MARK_MOUNT,
+                      FAN_OPEN_EXEC_PERM | FAN_CLOSE_WRITE, AT_FDCWD, mount.c_str()) != 0)
+        throw std::runtime_error("fanotify_mark " + mount + ": " + std::strerror(errno));
+}
+
+void OnAccessScanner::respond(Event& ev, bool allow) {
+    if (ev.answered.exchange(true)) return;
+
+    struct fanotify_response response;
+    response.fd = ev.fd;
+    response.response = allow ? FAN_ALLOW : FAN_DENY;
+    while (::write(fanFd, &response, sizeof(response)) < 0 && errno == EINTR) {}
+    inFlight--;
+
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - ev.received).count();
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if (latenciesUs.size() < LATENCY_SAMPLES) latenciesUs.push_back(static_cast<uint32_t>(us));
+    else latenciesUs[latencyCursor++ % LATENCY_SAMPLES] = static_cast<uint32_t>(us);
+}
+
+void OnAccessScanner::handle(const struct fanotify_event_metadata* meta) {
+    if (meta->mask & FAN_Q_OVERFLOW) {
+        overflows++;
+        return;
+    }
+    if (meta->fd < 0) return;
+
+    auto ev = std::make_shared<Event>(meta->fd, Clock::now());
+    const bool permission = (meta->mask & FAN_OPEN_EXEC_PERM) != 0;
+
+    if (permission) {
+        if (inFlight.load() >= maxPending) {
+            inFlight++;
+            overloaded++;
+            respond(*ev, true);
+            return;
+        }
+        inFlight++;
+        pending.push_back(ev);
+    }
+
+    // A write whose fd cannot be stat'ed has no key: it is scanned on its own.
+    std::pair<dev_t, ino_t> inode{0, 0};
+    struct stat st;
+    const bool keyed = !permission && ::fstat(ev->fd, &st) == 0;
+    if (keyed) {
+        inode = {st.st_dev, st.st_ino};
+        std::lock_guard<std::mutex> lock(writesMutex);
+        if (writesQueued.count(inode)) {
+            writesCoalesced++;
+            return;
+        }
+        if (writesQueued.size() >= maxWrites) {
+            writesDropped++;
+            return;
+        }
+        writesQueued.insert(inode);
+    }
+
+    // Exec permission checks block a process: they run in the interactive
+    // lane, and post-write scans run in the background lane and yield to them.
+    // The event loop never waits for the pool: if the queue is full, a
+    // permission event is allowed and a post-write scan dropped.
+    bool queued = pool.trySubmit([this, ev, permission, keyed, inode]() {
+        // Budget already spent: the answer was "allow", skip the work.
+        if (permission && ev->answered.load()) return;
+        // From here on a new write to the file needs a scan of its own.
+        if (keyed) {
+            std::lock_guard<std::mutex> lock(writesMutex);
+            writesQueued.erase(inode);
+        }
+
+        ScanLimits limits;
+        limits.pool = &pool;
+        limits.priority = permission ? Priority::Interactive : Priority::Background;
+        bool infected = isELFFile(ev->fd) && containsSignatureFd(ev->fd, signature, &limits);
+        scanned++;
+        if (permission) respond(*ev, !infected);
+
+        if (infected) {
+            if (permission) denied++;
+            std::lock_guard<std::mutex> lock(outputMutex);
+            std::cout << "!!! File \"" << describeFd(ev->fd) << "\" is infected!"
+                      << (permission ? " (execution denied)" : "") << std::endl;
+        } else if (limits.error) {
+            std::lock_guard<std::mutex> lock(outputMutex);
+            std::cerr << "Error: Cannot read \"" << describeFd(ev->fd)
+                      << "\": " << std::strerror(limits.error) << "\n";
+        }
+    }, permission ? Priority::Interactive : Priority::Background);
+
+    if (queued) return;
+    if (permission) {
+        overloaded++;
+        respond(*ev, true);
+    } else {
+        writesDropped++;
+        if (keyed) {
+            std::lock_guard<std::mutex> lock(writesMutex);
+            writesQueued.erase(inode);
+        }
+    }
+}
+
+void OnAccessScanner::expire() {
+    auto now = Clock::now();
+    while (!pending.empty()) {
+        Event& front = *pending.front();
+        if (!front.answered.load()) {
+            if (now < front.received + budget) break;
+            timedOut++;
+            respond(front, true);
+        }
+        pending.pop_front();
+    }
+}
+
+void OnAccessScanner::run() {
+    alignas(struct fanotify_event_metadata) char buf[64 * 1024];
+
+    while (!g_terminate) {
+        int timeout = -1;
+        if (!pending.empty()) {
+            auto left = pending.front()->received + budget - Clock::now();
+            timeout = std::max<int>(0, static_cast<int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(left).count()) + 1);
+        }
+
+        struct pollfd pfd = {fanFd, POLLIN, 0};
+        int ready = ::poll(&pfd, 1, timeout);
+        if (ready < 0 && errno != EINTR)
+            throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+
+        if (ready > 0) {
+            while (true) {
+                ssize_t len = ::read(fanFd, buf, sizeof(buf));
+                if (len <= 0) break;
+
+                auto* meta = reinterpret_cast<const struct fanotify_event_metadata*>(buf);
+                while (FAN_EVENT_OK(meta, len)) {
+                    if (meta->vers == FANOTIFY_METADATA_VERSION) handle(meta);
+                    meta = FAN_EVENT_NEXT(meta, len);
+                }
+            }
+        }
+        expire();
+    }
+}
+
+void OnAccessScanner::printSummary() const {
+    std::vector<uint32_t> sorted;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        sorted = latenciesUs;
+    }
+    std::sort(sorted.begin(), sorted.end());
+    auto pct = [&](double p) -> uint32_t {
+        return sorted.empty() ? 0 : sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+    };
+
+    std::cout << "\nOn-access summary: scanned " << scanned << ", denied " << denied
+              << ", allowed on budget " << timedOut << ", allowed on overload " << overloaded
+              << ", queue overflows " << overflows << "\n"
+              << "Write scans: coalesced " << writesCoalesced << ", dropped " << writesDropped << "\n"
+              << "Permission latency: p50 " << pct(0.50) << " us, p99 " << pct(0.99)
+              << " us (budget " << budget.count() << " ms)\n";
+}
+
+#endif  // __linux__
+
+int runOnAccessDaemon(const std::vector<std::string>& mounts, const std::vector<uint8_t>& signature,
+                      std::chrono::milliseconds budget, size_t maxPending, size_t maxWrites) {
+#ifdef __linux__
+    std::signal(SIGINT, onTerminate);
+    std::signal(SIGTERM, onTerminate);
+
+    try {
+        ThreadPool pool(hardwareThreads());
+        OnAccessScanner scanner(signature, pool, budget, maxPending, maxWrites);
+        for (const auto& mount : mounts) scanner.watch(mount);
+
+        std::cout << "On-access scanning started...\n";
+        scanner.run();
+        scanner.printSummary();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+#else
+    (void)mounts; (void)signature; (void)budget; (void)maxPending; (void)maxWrites;
+    std::cerr << "Error: --on-access requires Linux fanotify.\n";
+    return 1;
+#endif
+}
+
+// ------------------------- Watch Mode -------------------------
+//
+// --watch keeps an inotify watch on every directory of the tree. Events are
+// coalesced per path: a file is rescanned once no event has arrived for it
+// for the debounce window. Watches are added before a directory is listed, so
+// nothing created during the initial scan is missed; the stamp recorded when a
+// file is queued (dev/ino/mtime/ctime/size) suppresses the duplicate scan
+// that such an overlap would otherwise cause. Stamps are dropped once they
+// have settled, so the map tracks recent activity rather than the whole tree.
+// A directory renamed inside the tree keeps its watches under the new path;
+// one moved out of the tree loses them.
+
+#ifdef __linux__
+
+class WatchScanner {
+public:
+    WatchScanner(const std::vector<uint8_t>& signature, ThreadPool& pool,
+                 std::chrono::milliseconds debounce);
+    ~WatchScanner();
+
+    void initialScan(const fs::path& root);
+    void run();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    const std::vector<uint8_t>& signature;
+    ThreadPool& pool;
+    std::chrono::milliseconds debounce;
+    int inFd = -1;
+    fs::path root;
+
+    struct Queued {
+        DirStamp stamp;
+        Clock::time_point at;
+    };
+
+    std::map<int, fs::path> watches;                        // wd -> directory
+    std::map<std::string, Clock::time_point> lastEvent;     // path -> latest event
+    std::deque<std::pair<std::string, Clock::time_point>> due;
+    std::map<std::string, Queued> queued;                   // path -> stamp last queued
+    std::deque<std::pair<std::string, Clock::time_point>> settling;  // queue order
+    std::map<uint32_t, fs::path> movedFrom;                 // cookie -> old directory
+
+    std::mutex outputMutex;
+
+    void addTree(const fs::path& dir);
+    void moveTree(const std::string& from, const std::string& to);
+    void dropTree(const std::string& dir);
+    void touch(const std::string& path);
+    void scheduleScan(fs::path path);
+    void fireDue();
+    void pruneSettled();
+    Clock::time_point nextDeadline() const;
+};
+
+// True if path is dir itself or lies below it.
+bool isUnder(const std::string& path, const std::string& dir) {
+    return path.compare(0, dir.size(), dir) == 0 &&
+           (path.size() == dir.size() || path[dir.size()] == '/');
+}
+
+WatchScanner::WatchScanner(const std::vector<uint8_t>& sig, ThreadPool& p,
+                           std::chrono::milliseconds d)
+    : signature(sig), pool(p), debounce(d) {
+    inFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inFd < 0)
+        throw std::runtime_error(std::string("inotify_init1 failed: ") + std::strerror(errno));
+}
+
+WatchScanner::~WatchScanner() {
+    if (inFd >= 0) ::close(inFd);
+}
+
+void WatchScanner::initialScan(const fs::path& r) {
+    root = r;
+    addTree(root);
+}
+
+// Watch first, then list: anything created in between is seen twice at worst,
+// and the stamp check in scheduleScan collapses that to one scan.
+void WatchScanner::addTree(const fs::path& dir) {
+    int wd = inotify_add_watch(inFd, dir.c_str(),
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE |
+                               IN_MOVED_FROM | IN_ONLYDIR | IN_DONT_FOLLOW);
+    if (wd < 0) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cerr << "Error watching " << dir << ": " << std::strerror(errno) << "\n";
+        return;
+    }
+    watches[wd] = dir;
+
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        if (entry.is_directory() && !entry.is_symlink())
+            addTree(entry.path());
+        else if (fs::is_regular_file(entry.path()))
+            scheduleScan(entry.path());
+    }
+}
+
+void WatchScanner::touch(const std::string& path) {
+    auto now = Clock::now();
+    lastEvent[path] = now;
+    due.emplace_back(path, now + debounce);
+}
+
+// Rewrites every path under `from` after a rename inside the tree. Stamps
+// move with their files, so unchanged files are not rescanned; files still
+// waiting out their debounce window are re-armed under the new name.
+void WatchScanner::moveTree(const std::string& from, const std::string& to) {
+    auto renamed = [&](const std::string& path) { return to + path.substr(from.size()); };
+
+    for (auto& [wd, dir] : watches)
+        if (isUnder(dir.string(), from)) dir = renamed(dir.string());
+
+    for (auto it = queued.lower_bound(from); it != queued.end() &&
+                                             it->first.compare(0, from.size(), from) == 0;) {
+        if (!isUnder(it->first, from)) { ++it; continue; }
+        queued[renamed(it->first)] = it->second;
+        it = queued.erase(it);
+    }
+    for (auto& entry : settling)
+        if (isUnder(entry.first, from)) entry.first = renamed(entry.first);
+
+    std::vector<std::string> pending;
+    for (auto it = lastEvent.lower_bound(from); it != lastEvent.end() &&
+                                                it->first.compare(0, from.size(), from) == 0;) {
+        if (!isUnder(it->first, from)) { ++it; continue; }
+        pending.push_back(renamed(it->first));
+        it = lastEvent.erase(it);
+    }
+    for (const auto& path : pending) touch(path);
+}
+
+// A directory moved out of the tree: stop watching it and forget its files.
+void WatchScanner::dropTree(const std::string& dir) {
+    for (const auto& [wd, path] : watches)
+        if (isUnder(path.string(), dir)) inotify_rm_watch(inFd, wd);  // IN_IGNORED erases it
+
+    for (auto it = queued.lower_bound(dir); it != queued.end() &&
+                                            it->first.compare(0, dir.size(), dir) == 0;)
+        it = isUnder(it->first, dir) ? queued.erase(it) : std::next(it);
+    for (auto it = lastEvent.lower_bound(dir); it != lastEvent.end() &&
+                                               it->first.compare(0, dir.size(), dir) == 0;)
+        it = isUnder(it->first, dir) ? lastEvent.erase(it) : std::next(it);
+}
+
+void WatchScanner::scheduleScan(fs::path path) {
+    DirStamp stamp;
+    if (!statStamp(path, stamp, true)) return;
+
+    const auto now = Clock::now();
+    auto it = queued.find(path.string());
+    if (it != queued.end() && it->second.stamp == stamp) return;
+    queued[path.string()] = {stamp, now};
+    settling.emplace_back(path.string(), now);
+
+    pool.submit([this, path = std::move(path)]() {
+        try {
+            if (!isELFFile(path)) return;
+
+            if (containsSignatureBuffered(path, signature)) {
+                std::lock_guard<std::mutex> lock(outputMutex);
+                std::cout << "!!! File " << path << " is infected!" << std::endl;
+            }
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(outputMutex);
+            std::cerr << "Error scanning " << path << ": " << e.what() << "\n";
+        }
+    });
+}
+
+// Entries in `due` are in deadline order; an entry is stale if a later event
+// for the same path has pushed its deadline out.
+void WatchScanner::fireDue() {
+    auto now = Clock::now();
+    while (!due.empty() && due.front().second <= now) {
+        auto [path, deadline] = due.front();
+        due.pop_front();
+
+        auto it = lastEvent.find(path);
+        if (it == lastEvent.end() || it->second + debounce != deadline) continue;
+        lastEvent.erase(it);
+
+        if (fs::is_regular_file(path)) scheduleScan(path);
+    }
+    pruneSettled();
+}
+
+// A stamp only has to outlive the events that may still be in flight for
+// its file: the debounce window plus a margin for the initial listing.
+void WatchScanner::pruneSettled() {
+    const auto horizon = Clock::now() - debounce - std::chrono::seconds(1);
+    while (!settling.empty() && settling.front().second <= horizon) {
+        auto it = queued.find(settling.front().first);
+        if (it != queued.end() && it->second.at == settling.front().second) queued.erase(it);
+        settling.pop_front();
+    }
+}
+
+WatchScanner::Clock::time_point WatchScanner::nextDeadline() const {
+    auto deadline = Clock::time_point::max();
+    if (!due.empty()) deadline = due.front().second;
+    if (!settling.empty())
+        deadline = std::min(deadline, settling.front().second + debounce + std::chrono::seconds(1));
+    return deadline;
+}
+
+void WatchScanner::run() {
+    alignas(struct inotify_event) char buf[64 * 1024];
+
+    while (!g_terminate) {
+        int timeout = -1;
+        const auto deadline = nextDeadline();
+        if (deadline != Clock::time_point::max()) {
+            auto left = deadline - Clock::now();
+            timeout = std::max<int>(0, static_cast<int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(left).count()) + 1);
+        }
+
+        struct pollfd pfd = {inFd, POLLIN, 0};
+        int ready = ::poll(&pfd, 1, timeout);
+        if (ready < 0 && errno != EINTR)
+            throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+
+        while (ready > 0) {
+            ssize_t len = ::read(inFd, buf, sizeof(buf));
+            if (len <= 0) break;
+
+            for (char* p = buf; p < buf + len;) {
+                auto* ev = reinterpret_cast<struct inotify_event*>(p);
+                p += sizeof(struct inotify_event) + ev->len;
+
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    // Events were lost: re-list everything, stamps skip the rest.
+                    addTree(root);
+                    continue;
+                }
+                if (ev->mask & IN_IGNORED) {
+                    watches.erase(ev->wd);
+                    continue;
+                }
+
+                auto w = watches.find(ev->wd);
+                if (w == watches.end() || ev->len == 0) continue;
+                fs::path path = w->second / ev->name;
+
+                if (ev->mask & IN_ISDIR) {
+                    if (ev->mask & IN_MOVED_FROM) {
+                        movedFrom[ev->cookie] = path;
+                    } else if (ev->mask & IN_MOVED_TO) {
+                        auto from = movedFrom.find(ev->cookie);
+                        if (from != movedFrom.end()) {
+                            moveTree(from->second.string(), path.string());
+                            movedFrom.erase(from);
+                        } else {
+                            addTree(path);
+                        }
+                    } else if (ev->mask & IN_CREATE) {
+                        addTree(path);
+                    }
+                } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    queued.erase(path.string());
+                } else {
+                    touch(path.string());
+                }
+            }
+        }
+        // The kernel queues both halves of a rename together; a MOVED_FROM
+        // still unpaired after draining the queue left the watched tree.
+        for (const auto& [cookie, dir] : movedFrom) dropTree(dir.string());
+        movedFrom.clear();
+        fireDue();
+    }
+}
+
+#endif  // __linux__
+
+int runWatchMode(const fs::path& root, const std::vector<uint8_t>& signature,
+                 std::chrono::milliseconds debounce) {
+#ifdef __linux__
+    std::signal(SIGINT, onTerminate);
+    std::signal(SIGTERM, onTerminate);
+
+    try {
+        ThreadPool pool(hardwareThreads());
+        WatchScanner scanner(signature, pool, debounce);
+
+        std::cout << "Scanning started...\n\n";
+        scanner.initialScan(root);
+        std::cout << "Watching for changes..." << std::endl;
+        scanner.run();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+#else
+    (void)root; (void)signature; (void)debounce;
+    std::cerr << "Error: --watch requires Linux inotify.\n";
+    return 1;
+#endif
+}
+
+// ------------------------- Scan Engine -------------------------
+//
+// A signature and the pool that scans for it: the sweep in main(), the
+// socket daemon and libcrypty (crypty.h) all scan their files through one.
+// All state lives in the engine, so independent engines can share a
+// process. scan*() run on the calling thread; submit*() run on the pool
+// and hand the result to `done` there. Submitted scans follow the engine's
+// token: after cancel() they stop between chunks and report Cancelled. A
+// scan that throws reports its file unreadable; a `done` that throws is
+// counted in failures() and passed to `onFailure`, never printed.
+
+class ScanEngine {
+public:
+    // `threads` 0 means one per core; `numa` pins them per node.
+    ScanEngine(std::vector<uint8_t> signature, size_t threads, const NumaTopology* numa = nullptr,
+               ThreadPool::FailureHandler onFailure = [](const char*) {})
+        : signature(std::move(signature)),
+          pool(threads ? threads : hardwareThreads(), numa, std::move(onFailure)) {}
+    ~ScanEngine() { scans.wait(); }
+    ScanEngine(const ScanEngine&) = delete;
+    ScanEngine& operator=(const ScanEngine&) = delete;
+
+    void scanPath(const fs::path& path, FileResult& result) const {
+        ScanLimits limits = makeLimits(nullptr);
+        scanFile(path, signature, limits, result);
+    }
+    // With the caller's limits (its own token, budgets, instrumentation),
+    // as the sweep scans each file.
+    void scanPath(const fs::path& path, ScanLimits& limits, FileResult& result) const {
+        scanFile(path, signature, limits, result);
+    }
+    // A file expected to fit in `capacity` bytes, read whole into `buffer`.
+    void scanSmall(const fs::path& path, uint8_t* buffer, size_t capacity, ScanLimits& limits,
+                   FileResult& result) const {
+        scanSmallFile(path, signature, buffer, capacity, limits, result);
+    }
+    // A large file as parallel ranges on the pool, counted in `group`.
+    void scanSplit(const ScanItem& item, const ScanLimits& limits, TaskGroup* group,
+                   FileResultFn done) {
+        scanFileSplit(pool, group, item, signature, limits, std::move(done));
+    }
+    // The fd is read with pread and left open.
+    void scanFd(int fd, FileResult& result) const {
+        ScanLimits limits = makeLimits(nullptr);
+        scanOpenFile(fd, signature, limits, result);
+    }
+    void scanData(const uint8_t* data, size_t size, FileResult& result) const {
+        scanBuffer(data, size, signature, result);
+    }
+
+    void submitPath(fs::path path, FileResultFn done) {
+        pool.submit([this, path = std::move(path), done = std::move(done)]() {
+            FileResult result(path);
+            try {
+                ScanLimits limits = makeLimits(&pool);
+                scanFile(path, signature, limits, result);
+            } catch (...) {
+                result.setError(scanFailureError());
+            }
+            done(result);
+        }, &scans);
+    }
+    // The fd must stay open until `done` has run; `done` may close it.
+    void submitFd(int fd, FileResultFn done) {
+        pool.submit([this, fd, done = std::move(done)]() {
+            static const fs::path name = "fd";
+            FileResult result(name);
+            try {
+                ScanLimits limits = makeLimits(&pool);
+                scanOpenFile(fd, signature, limits, result);
+            } catch (...) {
+                result.setError(scanFailureError());
+            }
+            done(result);
+        }, &scans);
+    }
+    void submitData(std::shared_ptr<const std::vector<uint8_t>> data, FileResultFn done) {
+        pool.submit([this, data = std::move(data), done = std::move(done)]() {
+            static const fs::path name = "stream";
+            FileResult result(name);
+            try {
+                scanBuffer(data->data(), data->size(), signature, result);
+            } catch (...) {
+                result.setError(scanFailureError());
+            }
+            done(result);
+        }, &scans);
+    }
+
+    void cancel() { token.cancel(); }
+    // Until every submitted scan has returned from `done`. Not from `done`.
+    void wait() { scans.wait(); }
+    // For work of the caller's own, like the sweep's batches.
+    ThreadPool& threadPool() { return pool; }
+    uint64_t failures() const { return pool.failures(); }
+
+private:
+    const std::vector<uint8_t> signature;
+    CancellationToken token;
+    TaskGroup scans;
+    ThreadPool pool;                // last, so it is joined before the rest goes
+
+    ScanLimits makeLimits(ThreadPool* yieldTo) const {
+        ScanLimits limits;
+        limits.token = &token;
+        limits.pool = yieldTo;
+        return limits;
+    }
+};
+
+// ------------------------- Socket Daemon -------------------------
+//
+// --daemon <socket> keeps the signature and the pool resident and serves
+// scan requests on a Unix stream socket, one text line per request:
+//
+//   SCAN <path>        an absolute path; a directory is scanned recursively
+//   SCAN-FD            the file descriptor sent along with this line (SCM_RIGHTS)
+//   STREAM <length>    followed by <length> bytes of data to scan
+//
+// Requests are numbered per connection from 1 and may be pipelined. Every
+// reply line starts with the request's number, files of different requests
+// may interleave, and each request ends with one END line:
+//
+//   <n> "<path>": OK | FOUND <offset> | ERROR <reason>      (fd, stream for the others)
+//   <n> END <files> <infected> <errors>
+//
+// One thread per connection does all of its socket I/O; scans run on the
+// pool. At most --max-clients connections are served at once; the ones
+// over that get "0 ERROR too many connections" and are closed. A
+// connection has at most --client-inflight files in the pool at once, and
+// its requests (and directory walks) stop advancing while that many are
+// running or while it has not read its replies, so a slow client only
+// slows itself down. It is not read from while it has a full line buffer
+// or MAX_PENDING_FDS unclaimed descriptors.
+
+#ifdef __linux__
+
+// A path as the console output shows it: quoted, with quotes escaped.
+std::string quotedPath(const fs::path& path) {
+    std::ostringstream out;
+    out << path;
+    return out.str();
+}
+
+class SocketDaemon {
+public:
+    SocketDaemon(const std::string& socketPath, ScanEngine& engine, size_t maxClients,
+                 size_t clientInflight, uint64_t maxStream);
+    ~SocketDaemon();
+
+    // Accepts connections until SIGINT/SIGTERM, then waits for them to end.
+    void run();
+    void printSummary() const;
+
+private:
+    struct Client;
+    struct Request {
+        std::shared_ptr<Client> client;
+        uint64_t id = 0;
+        std::atomic<uint64_t> files{0}, infected{0}, errors{0};
+        size_t pending = 1;                 // files in the pool + the request itself; client->mutex
+    };
+    struct Walk {
+        std::shared_ptr<Request> request;
+        std::vector<fs::directory_iterator> stack;
+    };
+
+    static constexpr size_t MAX_LINE = 64 << 10;
+    static constexpr size_t OUTBOX_LIMIT = 256 << 10;  // unread replies before pausing
+    static constexpr size_t MAX_FDS = 16;              // per recvmsg
+    static constexpr size_t MAX_PENDING_FDS = 64;      // received, not yet claimed by SCAN-FD
+
+    const std::string socketPath;
+    ScanEngine& engine;
+    const size_t maxClients;
+    const size_t clientInflight;
+    const uint64_t maxStream;
+    int listenFd = -1;
+
+    std::mutex clientsMutex;
+    std::condition_variable clientsDone;
+    std::vector<Client*> clients;
+
+    std::mutex outputMutex;
+    std::atomic<uint64_t> connections{0}, rejected{0}, requests{0}, files{0}, infected{0}, errors{0};
+
+    void serve(std::shared_ptr<Client> client);
+    bool startRequest(const std::shared_ptr<Client>& client, std::string& input,
+                      std::deque<int>& fds, uint64_t& nextId, Walk& walk);
+    void stepWalk(Walk& walk);
+    void scanPath(const std::shared_ptr<Request>& request, fs::path path);
+    void scanFd(const std::shared_ptr<Request>& request, int fd);
+    void scanStream(const std::shared_ptr<Request>& request, std::vector<uint8_t> data);
+    void fail(Request& request, const std::string& name, const std::string& reason);
+    // `shown` names the file in the log of hits; defaults to `name`.
+    void complete(Request& request, const std::string& name, const FileResult& result,
+                  const std::string& shown = std::string());
+    void finish(Request& request, const std::string& line = std::string(), bool fileDone = false);
+};
+
+// Connection state shared with the scans running for it. Scans only append
+// to the outbox; the connection thread does the sending.
+struct SocketDaemon::Client {
+    int fd;
+    int wake;                               // eventfd: the outbox or a slot changed
+    std::mutex mutex;
+    std::string outbox;
+    size_t inFlight = 0;
+    bool woken = false;
+
+    explicit Client(int fd) : fd(fd), wake(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {}
+    ~Client() {
+        ::close(fd);
+        if (wake >= 0) ::close(wake);
+    }
+
+    void post(const std::string& line) {
+        std::lock_guard<std::mutex> lock(mutex);
+        outbox += line;
+        wakeLocked();
+    }
+    // With `mutex` held.
+    void wakeLocked() {
+        if (!woken) {
+            woken = true;
+            uint64_t one = 1;
+            ssize_t n = ::write(wake, &one, sizeof(one));
+            (void)n;
+        }
+    }
+};
+
+SocketDaemon::SocketDaemon(const std::string& socketPath, ScanEngine& engine, size_t maxClients,
+                           size_t clientInflight, uint64_t maxStream)
+    : socketPath(socketPath), engine(engine), maxClients(std::max<size_t>(1, maxClients)),
+      clientInflight(std::max<size_t>(1, clientInflight)), maxStream(maxStream) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("Socket path too long: " + socketPath);
+    std::memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) throw std::runtime_error(std::string("socket failed: ") + std::strerror(errno));
+    // A socket left by a daemon that died is replaced; a live one is not.
+    struct stat st;
+    if (::lstat(socketPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool live = ::connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+        ::close(probe);
+        if (live) {
+            ::close(listenFd);
+            throw std::runtime_error("A daemon is already listening on " + socketPath);
+        }
+        ::unlink(socketPath.c_str());
+    }
+    if (::bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::chmod(socketPath.c_str(), 0660) != 0 || ::listen(listenFd, 64) != 0) {
+        int error = errno;
+        ::close(listenFd);
+        throw std::runtime_error("Cannot listen on " + socketPath + ": " + std::strerror(error));
+    }
+}
+
+SocketDaemon::~SocketDaemon() {
+    ::close(listenFd);
+    ::unlink(socketPath.c_str());
+}
+
+void SocketDaemon::run() {
+    while (!g_terminate) {
+        struct pollfd pfd = {listenFd, POLLIN, 0};
+        int ready = ::poll(&pfd, 1, 200);
+        if (ready < 0 && errno != EINTR)
+            throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+        if (ready <= 0) continue;
+
+        int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0) continue;
+        bool full;
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            full = clients.size() >= maxClients;
+        }
+        if (full) {
+            static const char reply[] = "0 ERROR too many connections\n";
+            ssize_t n = ::send(fd, reply, sizeof(reply) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+            (void)n;
+            ::close(fd);
+            rejected++;
+            continue;
+        }
+        auto client = std::make_shared<Client>(fd);
+        if (client->wake < 0) continue;
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            clients.push_back(client.get());
+        }
+        connections++;
+        std::thread([this, client]() mutable {
+            serve(client);
+            Client* done = client.get();
+            client.reset();
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            clients.erase(std::find(clients.begin(), clients.end(), done));
+            clientsDone.notify_all();
+        }).detach();
+    }
+    // Connection threads notice g_terminate on their next poll.
+    engine.cancel();
+    {
+        std::unique_lock<std::mutex> lock(clientsMutex);
+        clientsDone.wait(lock, [this]() { return clients.empty(); });
+    }
+    engine.wait();
+}
+
+void SocketDaemon::serve(std::shared_ptr<Client> client) {
+    std::string input;
+    std::deque<int> fds;            // received with SCM_RIGHTS, claimed by SCAN-FD in order
+    uint64_t nextId = 0;
+    Walk walk;
+    bool reading = true;
+
+    while (true) {
+        // Start work while the client has free slots and reads its replies.
+        size_t outboxSize;
+        bool starved = false;       // no complete request left in `input`
+        while (true) {
+            size_t inFlight;
+            {
+                std::lock_guard<std::mutex> lock(client->mutex);
+                inFlight = client->inFlight;
+                outboxSize = client->outbox.size();
+            }
+            if (g_terminate || inFlight >= clientInflight || outboxSize >= OUTBOX_LIMIT) break;
+            if (walk.request) stepWalk(walk);
+            else if (!startRequest(client, input, fds, nextId, walk)) {
+                starved = true;
+                break;
+            }
+        }
+        // Reading pauses while MAX_PENDING_FDS are unclaimed; if no SCAN-FD
+        // is left to claim them, they never will be.
+        bool fdsFull = fds.size() + MAX_FDS > MAX_PENDING_FDS;
+        if (fdsFull && starved) {
+            for (int fd : fds) ::close(fd);
+            fds.clear();
+            fdsFull = false;
+        }
+
+        if (g_terminate && walk.request) {
+            finish(*walk.request);
+            walk = Walk();
+        }
+
+        // Send what the scans have posted.
+        bool idle;
+        {
+            std::lock_guard<std::mutex> lock(client->mutex);
+            while (!client->outbox.empty()) {
+                ssize_t n = ::send(client->fd, client->outbox.data(), client->outbox.size(),
+                                   MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0 && errno != EAGAIN) {
+                    client->outbox.clear();         // the client is gone
+                    reading = false;
+                    input.clear();
+                    walk = Walk();
+                }
+                if (n <= 0) break;
+                client->outbox.erase(0, static_cast<size_t>(n));
+            }
+            outboxSize = client->outbox.size();
+            // At shutdown, replies the client does not take are dropped.
+            idle = client->inFlight == 0 && !walk.request && (outboxSize == 0 || g_terminate);
+        }
+        if (idle && (!reading || g_terminate)) break;
+
+        // A partial STREAM may need more than a line's worth of input.
+        size_t wanted = MAX_LINE;
+        if (input.compare(0, 7, "STREAM ") == 0) wanted += static_cast<size_t>(maxStream);
+        struct pollfd pfds[2] = {{client->fd, 0, 0}, {client->wake, POLLIN, 0}};
+        if (reading && !g_terminate && input.size() < wanted && !fdsFull) pfds[0].events |= POLLIN;
+        if (outboxSize) pfds[0].events |= POLLOUT;
+        if (::poll(pfds, 2, 200) < 0 && errno != EINTR) break;
+
+        if (pfds[1].revents & POLLIN) {
+            uint64_t count;
+            std::lock_guard<std::mutex> lock(client->mutex);
+            ssize_t n = ::read(client->wake, &count, sizeof(count));
+            (void)n;
+            client->woken = false;
+        }
+        if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            char data[64 << 10];
+            alignas(struct cmsghdr) char control[CMSG_SPACE(MAX_FDS * sizeof(int))];
+            struct iovec iov = {data, sizeof(data)};
+            struct msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            ssize_t n = ::recvmsg(client->fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+            for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+                if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+                size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                const int* received = reinterpret_cast<const int*>(CMSG_DATA(c));
+                for (size_t i = 0; i < count; ++i) fds.push_back(received[i]);
+            }
+            if (n <= 0) reading = false;
+            else input.append(data, static_cast<size_t>(n));
+        }
+    }
+    for (int fd : fds) ::close(fd);
+}
+
+// Takes one complete request off the front of `input` and starts it. False
+// if there is none yet.
+bool SocketDaemon::startRequest(const std::shared_ptr<Client>& client, std::string& input,
+                                std::deque<int>& fds, uint64_t& nextId, Walk& walk) {
+    size_t end = input.find('\n');
+    if (end == std::string::npos) {
+        if (input.size() < MAX_LINE) return false;
+        end = input.size();         // no newline in sight: treat it as one bad request
+    }
+    std::string line = input.substr(0, end);
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+
+    uint64_t length = 0;
+    bool stream = line.compare(0, 7, "STREAM ") == 0;
+    if (stream) {
+        const char* first = line.c_str() + 7;
+        auto [ptr, ec] = std::from_chars(first, line.c_str() + line.size(), length);
+        if (ec != std::errc() || ptr == first || *ptr != '\0' || length > maxStream) {
+            stream = false;         // rejected below
+        } else if (input.size() < end + 1 + length) {
+            return false;           // wait for the whole body
+        }
+    }
+
+    auto request = std::make_shared<Request>();
+    request->client = client;
+    request->id = ++nextId;
+    requests++;
+
+    if (stream) {
+        const uint8_t* body = reinterpret_cast<const uint8_t*>(input.data()) + end + 1;
+        scanStream(request, std::vector<uint8_t>(body, body + length));
+        input.erase(0, end + 1 + length);
+    } else {
+        input.erase(0, std::min(input.size(), end + 1));
+        if (line.compare(0, 5, "SCAN ") == 0) {
+            fs::path path = line.substr(5);
+            struct stat st;
+            if (!path.is_absolute()) {
+                fail(*request, quotedPath(path), "path must be absolute");
+            } else if (::stat(path.c_str(), &st) != 0) {
+                fail(*request, quotedPath(path), std::strerror(errno));
+            } else if (S_ISDIR(st.st_mode)) {
+                std::error_code ec;
+                fs::directory_iterator top(path, ec);
+                if (ec) {
+                    fail(*request, quotedPath(path), ec.message());
+                } else {
+                    walk.request = request;
+                    walk.stack.push_back(std::move(top));
+                    return true;    // finished by the walk
+                }
+            } else {
+                scanPath(request, std::move(path));
+            }
+        } else if (line == "SCAN-FD") {
+            if (fds.empty()) {
+                fail(*request, "fd", "no file descriptor received");
+            } else {
+                scanFd(request, fds.front());
+                fds.pop_front();
+            }
+        } else if (line.compare(0, 7, "STREAM ") == 0) {
+            // Over the limit or malformed: the body cannot be skipped reliably.
+            fail(*request, "stream", "bad length (limit " + std::to_string(maxStream) + " bytes)");
+            input.clear();
+            for (int fd : fds) ::close(fd);
+            fds.clear();
+            finish(*request);
+            ::shutdown(client->fd, SHUT_RD);
+            return false;
+        } else {
+            fail(*request, "request", "unknown command");
+        }
+    }
+    finish(*request);
+    return true;
+}
+
+// Advances a directory walk by one entry. Unreadable directories are
+// reported and skipped; symlinks to directories are not followed.
+void SocketDaemon::stepWalk(Walk& walk) {
+    Request& request = *walk.request;
+    fs::directory_iterator& top = walk.stack.back();
+    if (top == fs::directory_iterator()) {
+        walk.stack.pop_back();
+        if (walk.stack.empty()) {
+            finish(request);
+            walk.request.reset();
+        }
+        return;
+    }
+    fs::path path = top->path();
+    std::error_code ec;
+    const bool directory = top->symlink_status(ec).type() == fs::file_type::directory;
+    top.increment(ec);
+    if (ec) {
+        fail(request, quotedPath(path.parent_path()), ec.message());
+        top = fs::directory_iterator();
+    }
+
+    if (directory) {
+        fs::directory_iterator child(path, ec);
+        if (ec) fail(request, quotedPath(path), ec.message());
+        else walk.stack.push_back(std::move(child));
+        return;
+    }
+    uint64_t size = 0;
+    errno = 0;
+    if (regularFileSize(path, size)) scanPath(walk.request, std::move(path));
+    else if (errno) fail(request, quotedPath(path), std::strerror(errno));
+}
+
+void SocketDaemon::scanPath(const std::shared_ptr<Request>& request, fs::path path) {
+    {
+        std::lock_guard<std::mutex> lock(request->client->mutex);
+        ++request->client->inFlight;
+        ++request->pending;
+    }
+    engine.submitPath(std::move(path), [this, request](const FileResult& result) {
+        complete(*request, quotedPath(result.path), result);
+    });
+}
+
+void SocketDaemon::scanFd(const std::shared_ptr<Request>& request, int fd) {
+    {
+        std::lock_guard<std::mutex> lock(request->client->mutex);
+        ++request->client->inFlight;
+        ++request->pending;
+    }
+    engine.submitFd(fd, [this, request, fd](const FileResult& result) {
+        std::string shown = result.hit >= 0 ? quotedPath(describeFd(fd)) : std::string();
+        ::close(fd);
+        complete(*request, "fd", result, shown);
+    });
+}
+
+void SocketDaemon::scanStream(const std::shared_ptr<Request>& request, std::vector<uint8_t> data) {
+    {
+        std::lock_guard<std::mutex> lock(request->client->mutex);
+        ++request->client->inFlight;
+        ++request->pending;
+    }
+    auto shared = std::make_shared<std::vector<uint8_t>>(std::move(data));
+    engine.submitData(std::move(shared), [this, request](const FileResult& result) {
+        complete(*request, "stream", result, "<stream>");
+    });
+}
+
+// A reply line for something that was not scanned; not a pool task.
+void SocketDaemon::fail(Request& request, const std::string& name, const std::string& reason) {
+    request.errors++;
+    errors++;
+    request.client->post(std::to_string(request.id) + " " + name + ": ERROR " + reason + "\n");
+}
+
+void SocketDaemon::complete(Request& request, const std::string& name, const FileResult& result,
+                            const std::string& shown) {
+    std::string line = std::to_string(request.id) + " " + name + ": ";
+    if (result.hit >= 0) {
+        line += "FOUND " + std::to_string(result.hit);
+        request.infected++;
+        infected++;
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cout << "!!! File " << (shown.empty() ? name : shown) << " is infected!" << std::endl;
+    } else if (result.reason == StopReason::Unreadable) {
+        line += std::string("ERROR ") + std::strerror(result.error);
+        request.errors++;
+        errors++;
+    } else if (result.reason != StopReason::None) {
+        line += std::string("ERROR ") + stopReasonName(result.reason);
+        request.errors++;
+        errors++;
+    } else {
+        line += "OK";
+    }
+    line += '\n';
+    request.files++;
+    files++;
+    finish(request, line, true);
+}
+
+// Queues `line` and drops one reference; the last one also queues the END
+// line. Both happen under the client's lock, so END follows every reply of
+// its request, and a file's slot is given back only once its reply (and
+// END) are queued, so the connection cannot see itself idle before that.
+void SocketDaemon::finish(Request& request, const std::string& line, bool fileDone) {
+    Client& client = *request.client;
+    std::lock_guard<std::mutex> lock(client.mutex);
+    client.outbox += line;
+    if (--request.pending == 0)
+        client.outbox += std::to_string(request.id) + " END " + std::to_string(request.files.load()) +
+                         " " + std::to_string(request.infected.load()) + " " +
+                         std::to_string(request.errors.load()) + "\n";
+    if (fileDone) --client.inFlight;
+    client.wakeLocked();
+}
+
+void SocketDaemon::printSummary() const {
+    std::cout << "\nDaemon summary: " << connections << " connections, " << rejected
+              << " rejected, " << requests
+              << " requests, " << files << " files scanned, " << infected << " infected, "
+              << errors << " errors\n";
+}
+
+#endif  // __linux__
+
+int runSocketDaemon(const std::string& socketPath, const std::vector<uint8_t>& signature,
+                    size_t maxClients, size_t clientInflight, uint64_t maxStream) {
+#ifdef __linux__
+    std::signal(SIGINT, onTerminate);
+    std::signal(SIGTERM, onTerminate);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    try {
+        // No onFailure: a reply that fails to post is printed, as in the other pools.
+        ScanEngine engine(signature, hardwareThreads(), nullptr, nullptr);
+        SocketDaemon daemon(socketPath, engine, maxClients, clientInflight, maxStream);
+        std::cout << "Listening on " << socketPath << "...\n" << std::flush;
+        daemon.run();
+        daemon.printSummary();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+#else
+    (void)socketPath; (void)signature; (void)maxClients; (void)clientInflight; (void)maxStream;
+    std::cerr << "Error: --daemon requires Linux.\n";
+    return 1;
+#endif
+}
+
+// ------------------------- Library API -------------------------
+//
+// The C functions of crypty.h, over ScanEngine. libcrypty.so is this file
+// built with -DCRYPTY_LIBRARY, which leaves out main(); with
+// -fvisibility=hidden only the crypty_* functions are exported. No C++
+// exception crosses the boundary: failures come back as errno values.
+
+struct crypty_engine {
+    ScanEngine scanner;
+
+    crypty_engine(std::vector<uint8_t> signature, size_t threads)
+        : scanner(std::move(signature), threads) {}
+};
+
+namespace {
+
+int toStatus(const FileResult& from, crypty_result* to) {
+    int status = from.hit >= 0                             ? CRYPTY_INFECTED
+                 : from.reason == StopReason::Unreadable  ? CRYPTY_ERROR
+                 : from.reason != StopReason::None        ? CRYPTY_INCOMPLETE
+                                                          : CRYPTY_CLEAN;
+    if (to) {
+        to->status = status;
+        to->error = status == CRYPTY_ERROR ? from.error : 0;
+        to->offset = from.hit;
+        to->elf_class = from.elf ? from.elfClass : -1;
+        to->bytes_read = from.bytesRead;
+    }
+    return status;
+}
+
+int invalid(crypty_result* result) {
+    if (result) *result = {CRYPTY_ERROR, EINVAL, -1, -1, 0};
+    return CRYPTY_ERROR;
+}
+
+// errno of a failed create: out of memory, threads not started, or bad input.
+int createError() {
+    try {
+        throw;
+    } catch (const std::bad_alloc&) {
+        return ENOMEM;
+    } catch (const std::system_error& e) {
+        return e.code().value() ? e.code().value() : EAGAIN;
+    } catch (...) {
+        return EINVAL;
+    }
+}
+
+}  // namespace
+
+extern "C" {
+
+int crypty_abi_version(void) { return CRYPTY_ABI_VERSION; }
+
+int crypty_engine_create(const void* signature, size_t size, unsigned threads,
+                         crypty_engine** engine) {
+    if (!engine) return EINVAL;
+    *engine = nullptr;
+    if (!signature || size == 0) return EINVAL;
+    try {
+        const uint8_t* bytes = static_cast<const uint8_t*>(signature);
+        *engine = new crypty_engine(std::vector<uint8_t>(bytes, bytes + size), threads);
+        return 0;
+    } catch (...) {
+        return createError();
+    }
+}
+
+int crypty_engine_create_from_file(const char* signature_path, unsigned threads,
+                                   crypty_engine** engine) {
+    if (!engine) return EINVAL;
+    *engine = nullptr;
+    if (!signature_path) return EINVAL;
+    std::vector<uint8_t> signature;
+    try {
+        errno = 0;
+        signature = load_signature(signature_path);
+    } catch (...) {
+        return errno ? errno : EINVAL;
+    }
+    return crypty_engine_create(signature.data(), signature.size(), threads, engine);
+}
+
+void crypty_engine_destroy(crypty_engine* engine) {
+    if (!engine) return;
+    engine->scanner.cancel();
+    delete engine;                  // waits for the callbacks
+}
+
+int crypty_scan_path(crypty_engine* engine, const char* path, crypty_result* result) {
+    if (!engine || !path) return invalid(result);
+    try {
+        const fs::path file(path);
+        FileResult scanned(file);
+        engine->scanner.scanPath(file, scanned);
+        return toStatus(scanned, result);
+    } catch (...) {
+        return invalid(result);
+    }
+}
+
+int crypty_scan_fd(crypty_engine* engine, int fd, crypty_result* result) {
+    if (!engine || fd < 0) return invalid(result);
+    static const fs::path name = "fd";
+    try {
+        FileResult scanned(name);
+        engine->scanner.scanFd(fd, scanned);
+        return toStatus(scanned, result);
+    } catch (...) {
+        return invalid(result);
+    }
+}
+
+int crypty_scan_buffer(crypty_engine* engine, const void* data, size_t size,
+                       crypty_result* result) {
+    if (!engine || (!data && size)) return invalid(result);
+    static const fs::path name = "buffer";
+    FileResult scanned(name);
+    engine->scanner.scanData(static_cast<const uint8_t*>(data), size, scanned);
+    return toStatus(scanned, result);
+}
+
+int crypty_submit_path(crypty_engine* engine, const char* path, crypty_callback callback,
+                       void* user) {
+    if (!engine || !path || !callback) return EINVAL;
+    try {
+        engine->scanner.submitPath(path, [callback, user](const FileResult& scanned) {
+            crypty_result result;
+            toStatus(scanned, &result);
+            callback(user, scanned.path.c_str(), &result);
+        });
+        return 0;
+    } catch (...) {
+        return ENOMEM;
+    }
+}
+
+int crypty_submit_fd(crypty_engine* engine, int fd, crypty_callback callback, void* user) {
+    if (!engine || fd < 0 || !callback) return EINVAL;
+    try {
+        engine->scanner.submitFd(fd, [callback, user](const FileResult& scanned) {
+            crypty_result result;
+            toStatus(scanned, &result);
+            callback(user, "fd", &result);
+        });
+        return 0;
+    } catch (...) {
+        return ENOMEM;
+    }
+}
+
+void crypty_wait(crypty_engine* engine) {
+    if (engine) engine->scanner.wait();
+}
+
+}  // extern "C"
+
+// ------------------------- Pool Benchmark -------------------------
+//
+// --bench-pool <tasks> measures scheduling throughput with tiny tasks that
+// stand in for small non-ELF files (hash 64 bytes, done), for thread counts
+// from 1 up to the number of cores, and prints the speedup over one thread.
+
+int runPoolBenchmark(size_t taskCount) {
+    size_t cores = hardwareThreads();
+    std::vector<size_t> counts;
+    for (size_t n = 1; n < cores; n *= 2) counts.push_back(n);
+    counts.push_back(cores);
+
+    std::cout << "threads  seconds  Mtasks/s  speedup\n";
+    double base = 0;
+    for (size_t n : counts) {
+        std::atomic<uint64_t> sink{0};
+        auto start = std::chrono::steady_clock::now();
+        {
+            ThreadPool pool(n);
+            for (size_t i = 0; i < taskCount; ++i) {
+                pool.submit([&sink, i]() {
+                    uint8_t block[64];
+                    std::memset(block, static_cast<int>(i), sizeof(block));
+                    sink.fetch_add(fnv1a(FNV_OFFSET, block, sizeof(block)) & 1,
+                                   std::memory_order_relaxed);
+                });
+            }
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double rate = taskCount / secs / 1e6;
+        if (base == 0) base = rate;
+
+        std::cout << std::setw(7) << n << "  " << std::fixed << std::setprecision(3)
+                  << std::setw(7) << secs << "  " << std::setw(8) << rate << "  "
+                  << std::setw(6) << std::setprecision(2) << rate / base << "x\n";
+    }
+    return 0;
+}
+
+// ------------------------- Options -------------------------
+
+struct Options {
+    std::string root_dir;
+    std::string sig_file;
+    std::string state_file;     // --state <file>: enables subtree pruning
+    std::vector<std::string> on_access_mounts;  // --on-access <mount>: daemon mode
+    size_t perm_budget_ms = 20;                 // --perm-budget-ms
+    size_t max_pending = 1024;                  // --max-pending
+    size_t max_queued_writes = 4096;            // --max-queued-writes
+    bool watch = false;                         // --watch: keep rescanning changes
+    size_t debounce_ms = 200;                   // --debounce-ms
+    std::string files_from;                     // --files-from <file|->: no walk
+    bool null_delimited = false;                // --null: manifest entries end in NUL
+    size_t lookahead = 1024;                    // --lookahead: size-ordering window
+    size_t bench_tasks = 0;                     // --bench-pool <tasks>: benchmark only
+    size_t split_mib = 256;                     // --split-mib: scan bigger files in parallel ranges
+    bool progress = false;                      // --progress: periodic status on stderr
+    bool stop_on_first = false;                 // --stop-on-first: CI gate, exit 2 on a hit
+    size_t file_timeout_ms = 0;                 // --file-timeout-ms: per-file time budget
+    size_t file_max_mib = 0;                    // --file-max-mib: per-file byte budget
+    std::string unscanned_file;                 // --unscanned <file>: list of skipped files
+    bool numa = false;                          // --numa: pin workers, node-local queues
+    bool pipeline = false;                      // --pipeline: staged open/read/match/report
+    ScanPipeline::Workers stage_threads;        // --stage-threads <open>,<read>,<match>
+    bool adaptive = false;                      // --adaptive: tune in-flight files and read size
+    size_t min_inflight = 1;                    // --min-inflight
+    size_t max_inflight = 0;                    // --max-inflight; 0 = 4 per core
+    size_t batch = 64;                          // --batch: small files per task
+    bool coroutines = false;                    // --coroutines: C++20 coroutine core
+    std::string jsonl_file;                     // --jsonl <file>: one JSON record per file
+    std::string csv_file;                       // --csv <file>: one CSV row per file
+    std::string metrics_file;                   // --metrics <file>: Prometheus textfile
+    size_t metrics_interval_s = 10;             // --metrics-interval: seconds between rewrites
+    bool stats = false;                         // --stats: phase latencies and rates at the end
+    std::string stats_shm;                      // --stats-shm <name>: live stats for crypty-top
+    std::string trace_file;                     // --trace <file>: Chrome trace-event JSON
+    size_t trace_sample = 1;                    // --trace-sample <n>: trace one file in n
+    bool perf_counters = false;                 // --perf-counters: cycles/B and IPC of matching
+    size_t slowest = 0;                         // --slowest <n>: report the n slowest files
+    std::string daemon_socket;                  // --daemon <socket>: serve scan requests
+    size_t max_clients = 64;                    // --max-clients: connections served at once
+    size_t client_inflight = 8;                 // --client-inflight: files per connection
+    size_t max_stream_mib = 64;                 // --max-stream-mib: largest STREAM request
+};
+
+void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options] <root_directory> <signature_file>\n"
+              << "       " << prog << " --files-from <file|-> [--null] <signature_file>\n"
+              << "       " << prog << " --daemon <socket> <signature_file>\n"
+              << "       " << prog << " --bench-pool <tasks>\n"
+              << "       " << prog << " --on-access <mount> [--on-access <mount>...] <signature_file>\n"
+              << "Options:\n"
+              << "  --state <file>        remember directory summaries and skip unchanged subtrees\n"
+              << "  --on-access <mount>   scan on exec/close-write via fanotify (daemon)\n"
+              << "  --perm-budget-ms <n>  allow an exec if its scan takes longer (default 20)\n"
+              << "  --max-pending <n>     allow immediately above n pending execs (default 1024)\n"
+              << "  --max-queued-writes <n> drop post-write scans above n queued (default 4096)\n"
+              << "  --watch               after the scan, rescan created/modified files (inotify)\n"
+              << "  --debounce-ms <n>     quiet time before a changed file is rescanned (default 200)\n"
+              << "  --files-from <file>   scan the paths listed in file ('-' for stdin) instead of walking\n"
+              << "  --null                manifest paths are NUL-terminated (find -print0, git -z)\n"
+              << "  --lookahead <n>       files held back to dispatch largest first (default 1024, 0 = off)\n"
+              << "  --split-mib <n>       scan files of n MiB or more as parallel ranges (default 256, 0 = off)\n"
+              << "  --progress            print files/bytes done, throughput and ETA every second\n"
+              << "  --stop-on-first       stop at the first infected file; exit 2 if one was found\n"
+              << "  --file-timeout-ms <n> stop scanning a file after n ms (reported as incomplete)\n"
+              << "  --file-max-mib <n>    scan at most the first n MiB of each file\n"
+              << "  --unscanned <file>    write paths of files not fully scanned to file\n"
+              << "  --numa                pin workers per NUMA node and prefer the storage device's node\n"
+              << "  --pipeline            scan in separate open/read/match/report stages\n"
+              << "  --stage-threads <o,r,m> threads for the open, read and match stages (default 2,cores,cores)\n"
+              << "  --adaptive            tune files in flight and read size to measured throughput\n"
+              << "  --min-inflight <n>    lower bound for --adaptive (default 1)\n"
+              << "  --max-inflight <n>    upper bound for --adaptive (default 4 per core)\n"
+              << "  --batch <n>           scan files under 4 KiB in tasks of n files (default 64, 0 = off)\n"
+              << "  --coroutines          scan files as coroutines over offloaded I/O (C++20 builds)\n"
+              << "  --jsonl <file>        write a JSON record for every file scanned to file\n"
+              << "  --csv <file>          write a CSV row for every file scanned to file\n"
+              << "  --metrics <file>      keep Prometheus metrics in file (node_exporter textfile)\n"
+              << "  --metrics-interval <s> seconds between metrics rewrites (default 10)\n"
+              << "  --stats               print GB/s, files/s and per-phase latencies after the scan\n"
+              << "  --stats-shm <name>    publish live per-worker stats in shared memory for crypty-top\n"
+              << "  --trace <file>        write per-thread phase spans as Chrome trace JSON (Perfetto)\n"
+              << "  --trace-sample <n>    trace about one file in n (default 1: all)\n"
+              << "  --perf-counters       print cycles/byte, IPC and miss rates of matching per engine\n"
+              << "  --slowest <n>         list the n slowest files with their time per phase\n"
+              << "  --max-clients <n>     --daemon: connections served at once (default 64)\n"
+              << "  --client-inflight <n> --daemon: files scanned at once per connection (default 8)\n"
+              << "  --max-stream-mib <n>  --daemon: largest STREAM request (default 64)\n";
+}
+
+bool parseOptions(int argc, char* argv[], Options& opts) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--state" && i + 1 < argc) {
+            opts.state_file = argv[++i];
+        } else if (arg == "--on-access" && i + 1 < argc) {
+            opts.on_access_mounts.push_back(argv[++i]);
+        } else if (arg == "--perm-budget-ms" && i + 1 < argc) {
+            opts.perm_budget_ms = std::stoul(argv[++i]);
+        } else if (arg == "--max-pending" && i + 1 < argc) {
+            opts.max_pending = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--max-queued-writes" && i + 1 < argc) {
+            opts.max_queued_writes = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--watch") {
+            opts.watch = true;
+        } else if (arg == "--debounce-ms" && i + 1 < argc) {
+            opts.debounce_ms = std::stoul(argv[++i]);
+        } else if (arg == "--files-from" && i + 1 < argc) {
+            opts.files_from = argv[++i];
+        } else if (arg == "--bench-pool" && i + 1 < argc) {
+            opts.bench_tasks = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--progress") {
+            opts.progress = true;
+        } else if (arg == "--stop-on-first") {
+            opts.stop_on_first = true;
+        } else if (arg == "--file-timeout-ms" && i + 1 < argc) {
+            opts.file_timeout_ms = std::stoul(argv[++i]);
+        } else if (arg == "--file-max-mib" && i + 1 < argc) {
+            opts.file_max_mib = std::stoul(argv[++i]);
+        } else if (arg == "--unscanned" && i + 1 < argc) {
+            opts.unscanned_file = argv[++i];
+        } else if (arg == "--split-mib" && i + 1 < argc) {
+            opts.split_mib = std::stoul(argv[++i]);
+        } else if (arg == "--lookahead" && i + 1 < argc) {
+            opts.lookahead = std::stoul(argv[++i]);
+        } else if (arg == "--numa") {
+            opts.numa = true;
+        } else if (arg == "--pipeline") {
+            opts.pipeline = true;
+        } else if (arg == "--stage-threads" && i + 1 < argc) {
+            std::stringstream list(argv[++i]);
+            std::string n;
+            size_t* counts[] = {&opts.stage_threads.open, &opts.stage_threads.read,
+                                &opts.stage_threads.match};
+            for (size_t k = 0; k < 3 && std::getline(list, n, ','); ++k)
+                *counts[k] = std::stoul(n);
+        } else if (arg == "--batch" && i + 1 < argc) {
+            opts.batch = std::stoul(argv[++i]);
+        } else if (arg == "--coroutines") {
+            opts.coroutines = true;
+        } else if (arg == "--jsonl" && i + 1 < argc) {
+            opts.jsonl_file = argv[++i];
+        } else if (arg == "--csv" && i + 1 < argc) {
+            opts.csv_file = argv[++i];
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            opts.metrics_file = argv[++i];
+        } else if (arg == "--metrics-interval" && i + 1 < argc) {
+            opts.metrics_interval_s = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--stats") {
+            opts.stats = true;
+        } else if (arg == "--stats-shm" && i + 1 < argc) {
+            opts.stats_shm = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            opts.trace_file = argv[++i];
+        } else if (arg == "--trace-sample" && i + 1 < argc) {
+            opts.trace_sample = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--perf-counters") {
+            opts.perf_counters = true;
+        } else if (arg == "--slowest" && i + 1 < argc) {
+            opts.slowest = std::stoul(argv[++i]);
+        } else if (arg == "--daemon" && i + 1 < argc) {
+            opts.daemon_socket = argv[++i];
+        } else if (arg == "--max-clients" && i + 1 < argc) {
+            opts.max_clients = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--client-inflight" && i + 1 < argc) {
+            opts.client_inflight = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--max-stream-mib" && i + 1 < argc) {
+            opts.max_stream_mib = std::stoul(argv[++i]);
+        } else if (arg == "--adaptive") {
+            opts.adaptive = true;
+        } else if (arg == "--min-inflight" && i + 1 < argc) {
+            opts.min_inflight = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--max-inflight" && i + 1 < argc) {
+            opts.max_inflight = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--null" || arg == "-0") {
+            opts.null_delimited = true;
+        } else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return false;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (opts.bench_tasks > 0) return positional.empty();
+    if (!opts.on_access_mounts.empty() || !opts.files_from.empty() || !opts.daemon_socket.empty()) {
+        if (positional.size() != 1) return false;
+        opts.sig_file = positional[0];
+        return true;
+    }
+    if (positional.size() != 2) return false;
+
+    opts.root_dir = positional[0];
+    opts.sig_file = positional[1];
+    return true;
+}
+
+// ------------------------- Manifest Input -------------------------
+
+// Reads the next path from a NUL- or newline-delimited list, skipping empty
+// entries and a trailing '\r' from CRLF files. False at end of input.
+bool readManifestEntry(std::istream& in, std::string& entry, bool nulDelimited) {
+    while (std::getline(in, entry, nulDelimited ? '\0' : '\n')) {
+        if (!nulDelimited && !entry.empty() && entry.back() == '\r')
+            entry.pop_back();
+        if (!entry.empty()) return true;
+    }
+    return false;
+}
+
+// ------------------------- Result Output -------------------------
+//
+// Result lines do not share a lock and std::cout. Each thread appends to its
+// own single-producer byte ring; one writer thread drains all rings into a
+// large buffer and hands it to write(2), so workers neither wait for each
+// other nor for the terminal. The writer drains at least every
+// FLUSH_INTERVAL and on flush(), which returns once everything written
+// before it is out: little is lost if the process dies, and nothing once
+// the scan has been flushed. A line stays whole if it fits in a ring.
+
+class OutputWriter {
 public:
-    explicit ThreadPool(size_t threadCount);
-    ~ThreadPool();
-    void submit(std::function<void()> task);
+    explicit OutputWriter(int fd);
+    ~OutputWriter();
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    // Any thread. Blocks only while the calling thread's ring is full.
+    void write(const char* data, size_t n);
+    void write(const std::string& text) { write(text.data(), text.size()); }
+    void flush();
 
 private:
-    std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
-    std::mutex queueMutex;
-    std::condition_variable condition;
-    std::atomic<bool> stop;
+    static constexpr size_t RING_SIZE = 64 << 10;
+    static constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(20);
 
-    void workerThread();
+    struct Ring {
+        alignas(64) std::atomic<size_t> head{0};    // consumer position
+        alignas(64) std::atomic<size_t> tail{0};    // producer position
+        char data[RING_SIZE];
+    };
+
+    const int fd;
+    PerThread<Ring> rings;
+
+    std::mutex wakeMutex;
+    std::condition_variable wake, flushed;
+    bool wakeRequested = false;
+    bool stopping = false;
+    uint64_t flushRequested = 0, flushDone = 0;
+    std::thread writer;
+
+    void requestDrain();
+    void writerLoop();
 };
 
-ThreadPool::ThreadPool(size_t threadCount) : stop(false) {
-    for (size_t i = 0; i < threadCount; ++i) {
-        workers.emplace_back([this]() { workerThread(); });
+OutputWriter::OutputWriter(int fd) : fd(fd) {
+    writer = std::thread([this]() { writerLoop(); });
+}
+
+OutputWriter::~OutputWriter() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping = true;
     }
+    wake.notify_one();
+    writer.join();
 }
 
-ThreadPool::~ThreadPool() {
-    stop = true;
-    condition.notify_all();
-    for (auto& t : workers)
-        if (t.joinable()) t.join();
+void OutputWriter::write(const char* data, size_t n) {
+    Ring& ring = rings.local();
+    while (n > 0) {
+        size_t piece = std::min(n, RING_SIZE);
+        size_t tail = ring.tail.load(std::memory_order_relaxed);
+        while (RING_SIZE - (tail - ring.head.load(std::memory_order_acquire)) < piece) {
+            requestDrain();
+            std::this_thread::yield();
+        }
+        for (size_t i = 0; i < piece; ++i)
+            ring.data[(tail + i) % RING_SIZE] = data[i];
+        ring.tail.store(tail + piece, std::memory_order_release);
+        // More than half full: do not wait for the timer.
+        if (tail + piece - ring.head.load(std::memory_order_relaxed) > RING_SIZE / 2) requestDrain();
+        data += piece;
+        n -= piece;
+    }
 }
 
-void ThreadPool::submit(std::function<void()> task) {
+void OutputWriter::requestDrain() {
     {
-        std::lock_guard<std::mutex> lock(queueMutex);
-        tasks.push(std::move(task));
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        wakeRequested = true;
     }
-    condition.notify_one();
+    wake.notify_one();
 }
 
-void ThreadPool::workerThread() {
-    while (true) {
-        std::function<void()> task;
+void OutputWriter::flush() {
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    uint64_t ticket = ++flushRequested;
+    wakeRequested = true;
+    wake.notify_one();
+    flushed.wait(lock, [&]() { return flushDone >= ticket; });
+}
 
+void OutputWriter::writerLoop() {
+    std::string out;
+    out.reserve(1 << 20);
+    std::vector<Ring*> snapshot;
+    while (true) {
+        uint64_t ticket;
+        bool last;
         {
-            std::unique_lock<std::mutex> lock(queueMutex);
-            condition.wait(lock, [this]() {
-                return stop || !tasks.empty();
-            });
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wake.wait_for(lock, FLUSH_INTERVAL, [this]() { return wakeRequested || stopping; });
+            wakeRequested = false;
+            ticket = flushRequested;
+            last = stopping;
+        }
+        snapshot.clear();
+        rings.forEach([&snapshot](Ring& ring) { snapshot.push_back(&ring); });
+        for (Ring* ring : snapshot) {
+            size_t head = ring->head.load(std::memory_order_relaxed);
+            size_t tail = ring->tail.load(std::memory_order_acquire);
+            for (size_t i = head; i != tail; ++i)
+                out.push_back(ring->data[i % RING_SIZE]);
+            ring->head.store(tail, std::memory_order_release);
+        }
+        for (size_t done = 0; done < out.size();) {
+            ssize_t r = ::write(fd, out.data() + done, out.size() - done);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) break;      // stdout gone: drop, as std::cout would
+            done += static_cast<size_t>(r);
+        }
+        out.clear();
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            flushDone = ticket;
+        }
+        flushed.notify_all();
+        if (last) return;
+    }
+}
+
+// Appends `text` the way `std::cout << path` prints it: in double quotes,
+// with '"' and '\\' escaped. Reuses the caller's buffer.
+void appendQuoted(std::string& out, const std::string& text) {
+    out.push_back('"');
+    for (char c : text) {
+        if (c == '"' || c == '\\') out.push_back('\\');
+        out.push_back(c);
+    }
+    out.push_back('"');
+}
 
-            if (stop && tasks.empty()) return;
+// ------------------------- Structured Reports -------------------------
+//
+// --jsonl/--csv write one record per file scanned, clean ones included, for
+// tools that would otherwise have to parse the "!!! File" lines. Records go
+// through their own OutputWriter; each is formatted into a thread-local
+// buffer with std::to_chars, so a record costs no allocation once the
+// buffer has grown to the longest path.
+//
+// JSON strings escape '"', '\\' and control characters; other bytes are
+// copied as they are, so paths that are not UTF-8 stay byte-exact but make
+// that line invalid JSON. CSV follows RFC 4180: the path is always quoted,
+// with '"' doubled.
 
-            task = std::move(tasks.front());
-            tasks.pop();
-        }
+enum class ReportFormat { Jsonl, Csv };
 
-        try {
-            task();
-        } catch (...) {
-            // Optional: handle uncaught exceptions here
+class ReportWriter {
+public:
+    // Creates or truncates `path`; throws if it cannot be opened.
+    ReportWriter(const std::string& path, ReportFormat format, uint64_t signatureId);
+    ~ReportWriter();
+    ReportWriter(const ReportWriter&) = delete;
+    ReportWriter& operator=(const ReportWriter&) = delete;
+
+    // Any thread.
+    void add(const FileResult& result);
+    void flush() { out->flush(); }
+
+private:
+    const ReportFormat format;
+    char signatureHex[16];
+    int fd;
+    std::unique_ptr<OutputWriter> out;
+
+    void appendJson(std::string& line, const FileResult& result) const;
+    void appendCsv(std::string& line, const FileResult& result) const;
+};
+
+ReportWriter::ReportWriter(const std::string& path, ReportFormat format, uint64_t signatureId)
+    : format(format) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 15; i >= 0; --i, signatureId >>= 4) signatureHex[i] = digits[signatureId & 15];
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) throw std::runtime_error("Cannot open report " + path + ": " + std::strerror(errno));
+    out.reset(new OutputWriter(fd));
+    if (format == ReportFormat::Csv)
+        out->write(std::string("path,inode,size,elf_class,signature,status,stopped,"
+                               "match_offsets,bytes_read,scan_ns,errno\n"));
+}
+
+ReportWriter::~ReportWriter() {
+    out.reset();        // drains the rings
+    ::close(fd);
+}
+
+void appendNumber(std::string& out, uint64_t value) {
+    char digits[20];
+    auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+    out.append(digits, end);
+}
+
+void appendJsonString(std::string& out, const std::string& text) {
+    static const char hex[] = "0123456789abcdef";
+    out.push_back('"');
+    for (char c : text) {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (c == '\n') {
+            out.append("\\n");
+        } else if (c == '\t') {
+            out.append("\\t");
+        } else if (c == '\r') {
+            out.append("\\r");
+        } else if (u < 0x20 || u == 0x7F) {
+            out.append("\\u00");
+            out.push_back(hex[u >> 4]);
+            out.push_back(hex[u & 15]);
+        } else {
+            out.push_back(c);
         }
     }
+    out.push_back('"');
 }
 
-// ------------------------- Helpers -------------------------
-
-bool isELFFile(const fs::path& path) {
-    std::ifstream file(path, std::ios::binary);
-    if (!file) return false;
+void appendCsvString(std::string& out, const std::string& text) {
+    out.push_back('"');
+    for (char c : text) {
+        if (c == '"') out.push_back('"');
+        out.push_back(c);
+    }
+    out.push_back('"');
+}
 
-    char header[4];
-    file.read(header, 4);
-    if (file.gcount() < 4) return false;
+const char* reportStatus(const FileResult& result) {
+    if (result.hit >= 0 || result.cached) return "infected";
+    if (result.reason == StopReason::Unreadable) return "error";
+    return result.reason == StopReason::None ? "clean" : "incomplete";
+}
 
-    return (header[0] == 0x7F && header[1] == 'E' &&
-            header[2] == 'L' && header[3] == 'F');
+// Machine-readable counterpart of stopReasonName().
+const char* reportStopName(StopReason reason) {
+    switch (reason) {
+        case StopReason::Cancelled:  return "cancelled";
+        case StopReason::Deadline:   return "deadline";
+        case StopReason::ByteBudget: return "byte_budget";
+        case StopReason::Unreadable: return "unreadable";
+        default:                     return "";
+    }
 }
 
-// Load signature into RAM
-std::vector<uint8_t> load_signature(const std::string& path) {
-    if (!fs::is_regular_file(path))
-        throw std::runtime_error("Signature path is not a regular file.");
+void ReportWriter::appendJson(std::string& line, const FileResult& result) const {
+    line.append("{\"path\":");
+    appendJsonString(line, result.path.native());
+    line.append(",\"inode\":");
+    appendNumber(line, result.inode);
+    line.append(",\"size\":");
+    appendNumber(line, result.size);
+    line.append(",\"elf_class\":");
+    if (result.elf) appendNumber(line, result.elfClass);     // 0: ELF, class unknown
+    else line.append("null");
+    line.append(",\"signature\":\"");
+    line.append(signatureHex, sizeof(signatureHex));
+    line.append("\",\"status\":\"");
+    line.append(reportStatus(result));
+    line.append("\",\"stopped\":");
+    if (result.reason == StopReason::None) {
+        line.append("null");
+    } else {
+        line.push_back('"');
+        line.append(reportStopName(result.reason));
+        line.push_back('"');
+    }
+    line.append(",\"matches\":");
+    if (result.cached) {
+        line.append("null");        // replayed from --state, not read this run
+    } else {
+        line.push_back('[');
+        if (result.hit >= 0) appendNumber(line, static_cast<uint64_t>(result.hit));
+        line.push_back(']');
+    }
+    line.append(",\"bytes_read\":");
+    appendNumber(line, result.bytesRead);
+    line.append(",\"scan_ns\":");
+    appendNumber(line, result.scanNs);
+    line.append(",\"errno\":");
+    if (result.error) appendNumber(line, static_cast<uint64_t>(result.error));
+    else line.append("null");
+    line.append("}\n");
+}
 
-    std::ifstream file(path, std::ios::binary);
-    if (!file) throw std::runtime_error("Cannot open signature file: " + path);
+void ReportWriter::appendCsv(std::string& line, const FileResult& result) const {
+    appendCsvString(line, result.path.native());
+    line.push_back(',');
+    appendNumber(line, result.inode);
+    line.push_back(',');
+    appendNumber(line, result.size);
+    line.push_back(',');
+    if (result.elf) appendNumber(line, result.elfClass);
+    line.push_back(',');
+    line.append(signatureHex, sizeof(signatureHex));
+    line.push_back(',');
+    line.append(reportStatus(result));
+    line.push_back(',');
+    if (result.reason != StopReason::None) line.append(reportStopName(result.reason));
+    line.push_back(',');
+    if (result.hit >= 0) appendNumber(line, static_cast<uint64_t>(result.hit));
+    line.push_back(',');
+    appendNumber(line, result.bytesRead);
+    line.push_back(',');
+    appendNumber(line, result.scanNs);
+    line.push_back(',');
+    if (result.error) appendNumber(line, static_cast<uint64_t>(result.error));
+    line.push_back('\n');
+}
 
-    return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), {});
+void ReportWriter::add(const FileResult& result) {
+    thread_local std::string line;
+    line.clear();
+    if (format == ReportFormat::Jsonl) appendJson(line, result);
+    else appendCsv(line, result);
+    out->write(line);
 }
 
-// Buffered read with sliding window
-bool containsSignatureBuffered(const fs::path& path, const std::vector<uint8_t>& signature) {
-    if (signature.empty()) return false;
+// ------------------------- Forensics -------------------------
+//
+// End-of-scan report for tuning exclusions and finding storage hot spots:
+// the --slowest <n> files by scan time with their time per phase, and every
+// failed open, read or stat grouped by errno with a few sample paths. Each
+// thread keeps its own bounded min-heap of slow files, so a file usually
+// costs one comparison with that thread's n-th slowest; the heaps are
+// merged for the report. Failures are rare and share one mutex.
 
-    const size_t OVERLAP = signature.size() - 1;
-    std::ifstream file(path, std::ios::binary);
-    if (!file) return false;
+class ScanForensics {
+public:
+    static constexpr size_t SAMPLES = 5;        // paths kept per errno
 
-    //buffer size should be bigger then signature
-    size_t buffer_size = std::max(MIN_BUFFER_SIZE, signature.size() + EXTRA_BUFFER);
+    explicit ScanForensics(size_t slowest)
+        : slowest(slowest), heaps([slowest]() {
+              std::unique_ptr<std::vector<SlowFile>> heap(new std::vector<SlowFile>());
+              heap->reserve(slowest);
+              return heap;
+          }) {}
+    ScanForensics(const ScanForensics&) = delete;
+    ScanForensics& operator=(const ScanForensics&) = delete;
 
-    std::vector<uint8_t> buffer(buffer_size + OVERLAP);
-    size_t bytesRead = 0;
+    // Whether scans should fill FileResult::phases.
+    bool timesPhases() const { return slowest > 0; }
 
-    while (file) {
-        if (bytesRead >= OVERLAP) {
-            std::copy(buffer.end() - OVERLAP, buffer.end(), buffer.begin());
-        } else if (bytesRead > 0) {
-            std::copy(buffer.begin() + bytesRead - OVERLAP, buffer.begin() + bytesRead, buffer.begin());
-        }
+    // Any thread, once per file.
+    void add(const FileResult& result);
+    void addError(int error, const fs::path& path);
+    // Once the scan is over.
+    void printReport(std::ostream& out) const;
+
+private:
+    struct SlowFile {
+        uint64_t scanNs = 0;
+        uint64_t size = 0;
+        uint64_t phaseNs[PHASES] = {};
+        fs::path path;
 
-        file.read(reinterpret_cast<char*>(buffer.data() + OVERLAP), buffer_size);
-        bytesRead = static_cast<size_t>(file.gcount());
-        size_t totalBytes = bytesRead + OVERLAP;
+        bool operator>(const SlowFile& o) const { return scanNs > o.scanNs; }
+    };
+    struct Failures {
+        uint64_t count = 0;
+        std::vector<fs::path> samples;
+    };
+
+    const size_t slowest;
+    PerThread<std::vector<SlowFile>> heaps;     // min-heaps of each thread's slowest
+    mutable std::mutex mutex;                   // failures
+    std::map<int, Failures> failures;
+};
+
+void ScanForensics::add(const FileResult& result) {
+    if (result.error) addError(result.error, result.path);
+    if (slowest == 0 || result.cached) return;
+
+    std::vector<SlowFile>& heap = heaps.local();
+    if (heap.size() == slowest && result.scanNs <= heap.front().scanNs) return;
+    SlowFile file;
+    file.scanNs = result.scanNs;
+    file.size = result.size;
+    if (result.phases)
+        for (size_t p = 0; p < PHASES; ++p)
+            file.phaseNs[p] = result.phases->ns[p].load(std::memory_order_relaxed);
+    file.path = result.path;
+    if (heap.size() == slowest) {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<SlowFile>());
+        heap.back() = std::move(file);
+    } else {
+        heap.push_back(std::move(file));
+    }
+    std::push_heap(heap.begin(), heap.end(), std::greater<SlowFile>());
+}
+
+void ScanForensics::addError(int error, const fs::path& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Failures& f = failures[error];
+    ++f.count;
+    if (f.samples.size() < SAMPLES) f.samples.push_back(path);
+}
 
-        auto it = std::search(buffer.begin(), buffer.begin() + totalBytes,
-                              signature.begin(), signature.end());
+void ScanForensics::printReport(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream text;
+    if (slowest > 0) {
+        std::vector<SlowFile> files;
+        heaps.forEach([&files](const std::vector<SlowFile>& heap) {
+            files.insert(files.end(), heap.begin(), heap.end());
+        });
+        std::sort(files.begin(), files.end(), std::greater<SlowFile>());
+        if (files.size() > slowest) files.resize(slowest);
 
-        if (it != buffer.begin() + totalBytes) {
-            return true;
+        static const Phase shown[] = {Phase::Open, Phase::Magic, Phase::Read, Phase::Match};
+        text << "\nSlowest files (ms; open, magic, read, match):\n" << std::fixed;
+        for (const auto& file : files) {
+            text << std::setprecision(3) << std::setw(10) << file.scanNs / 1e6 << " ms "
+                 << std::setw(12) << file.size << " B  ";
+            for (Phase phase : shown)
+                text << file.phaseNs[static_cast<size_t>(phase)] / 1e6
+                     << (phase == Phase::Match ? "  " : " / ");
+            text << file.path << "\n";
+        }
+    }
+    if (!failures.empty()) {
+        text << "\nFailures by errno:\n";
+        for (const auto& [error, f] : failures) {
+            text << "  errno " << error << " (" << std::strerror(error) << "): " << f.count
+                 << (f.count == 1 ? " file\n" : " files\n");
+            for (const auto& path : f.samples) text << "    " << path << "\n";
+            if (f.count > f.samples.size())
+                text << "    ... and " << f.count - f.samples.size() << " more\n";
         }
+    }
+    out << text.str();
+}
+
+// ------------------------- Progress -------------------------
+
+// One status line on stderr: done/total, throughput so far and ETA by bytes.
+void printProgress(const TaskGroup::Progress& p, uint64_t filesTotal, uint64_t bytesTotal,
+                   std::chrono::steady_clock::duration elapsed) {
+    double secs = std::chrono::duration<double>(elapsed).count();
+    double rate = secs > 0 ? p.bytesDone / secs : 0;
+    double eta = rate > 0 && bytesTotal > p.bytesDone ? (bytesTotal - p.bytesDone) / rate : 0;
+
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1)
+         << "Progress: " << p.filesDone << "/" << filesTotal << " files, "
+         << p.bytesDone / 1048576.0 << "/" << bytesTotal / 1048576.0 << " MiB, "
+         << rate / 1048576.0 << " MiB/s, " << p.running << " in flight, ETA "
+         << std::setprecision(0) << eta << " s\n";
+    std::cerr << line.str();
+}
+
+// Lists files that were not scanned to the end: a count per reason on
+// stdout, the paths to `listFile` if given, otherwise the first few on stderr.
+void reportIncomplete(const std::vector<std::pair<fs::path, StopReason>>& incomplete,
+                      const std::string& listFile) {
+    std::map<StopReason, size_t> counts;
+    for (const auto& entry : incomplete) counts[entry.second]++;
 
-        if (bytesRead < buffer_size) break;
+    std::cout << "\nNot fully scanned: " << incomplete.size() << " files (";
+    const char* sep = "";
+    for (const auto& [reason, n] : counts) {
+        std::cout << sep << n << " " << stopReasonName(reason);
+        sep = ", ";
     }
+    std::cout << ")\n";
 
-    return false;
+    if (!listFile.empty()) {
+        std::ofstream out(listFile, std::ios::trunc);
+        for (const auto& [path, reason] : incomplete)
+            out << path.string() << "\t" << stopReasonName(reason) << "\n";
+        if (!out) std::cerr << "Error: Cannot write " << listFile << "\n";
+        return;
+    }
+
+    constexpr size_t SHOWN = 20;
+    for (size_t i = 0; i < incomplete.size() && i < SHOWN; ++i)
+        std::cerr << "Not fully scanned (" << stopReasonName(incomplete[i].second) << "): "
+                  << incomplete[i].first << "\n";
+    if (incomplete.size() > SHOWN)
+        std::cerr << "... and " << incomplete.size() - SHOWN << " more (use --unscanned <file>)\n";
 }
 
 // ------------------------- Main -------------------------
 
+#ifndef CRYPTY_LIBRARY
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <root_directory> <signature_file>\n";
+    Options opts;
+    bool parsed = false;
+    try {
+        parsed = parseOptions(argc, argv, opts);
+    } catch (const std::exception&) {
+        std::cerr << "Invalid numeric option value.\n";
+    }
+    if (!parsed) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (opts.bench_tasks > 0) return runPoolBenchmark(opts.bench_tasks);
+
+    // The state records directories; a manifest has none to prune or record.
+    if (!opts.state_file.empty() && !opts.files_from.empty()) {
+        std::cerr << "Error: --state cannot be combined with --files-from.\n";
         return 1;
     }
 
-    std::string root_dir = argv[1];
-    std::string sig_file = argv[2];
+#ifndef CRYPTY_COROUTINES
+    if (opts.coroutines) {
+        std::cerr << "Note: built without C++20 coroutines; --coroutines ignored.\n";
+        opts.coroutines = false;
+    }
+#endif
+
     std::vector<uint8_t> signature;
 
     try {
-        signature = load_signature(sig_file);
+        signature = load_signature(opts.sig_file);
         if (signature.empty())
             throw std::runtime_error("Signature file is empty.");
     } catch (const std::exception& ex) {
@@ -192,41 +5497,467 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    if (!opts.on_access_mounts.empty())
+        return runOnAccessDaemon(opts.on_access_mounts, signature,
+                                 std::chrono::milliseconds(opts.perm_budget_ms), opts.max_pending,
+                                 opts.max_queued_writes);
+
+    if (!opts.daemon_socket.empty())
+        return runSocketDaemon(opts.daemon_socket, signature, opts.max_clients, opts.client_inflight,
+                               static_cast<uint64_t>(opts.max_stream_mib) << 20);
+
+    if (opts.watch)
+        return runWatchMode(opts.root_dir, signature, std::chrono::milliseconds(opts.debounce_ms));
+
     std::cout << "Scanning started...\n\n";
 
-    std::vector<fs::path> files;
+    // A different signature invalidates everything recorded in the state.
+    DirectoryState state(fnv1a(FNV_OFFSET, signature.data(), signature.size()));
+    std::vector<ScanItem> files;
+    std::vector<fs::path> replayed;
+    std::unique_ptr<ScanMetrics> metrics;
+    if (!opts.metrics_file.empty() || opts.stats) metrics.reset(new ScanMetrics());
+    std::unique_ptr<TraceRecorder> trace;
+    if (!opts.trace_file.empty()) trace.reset(new TraceRecorder(opts.trace_sample));
+    std::unique_ptr<PerfCounters> perf;
+    if (opts.perf_counters) perf.reset(new PerfCounters());
+    ScanForensics forensics(opts.slowest);
+    std::unique_ptr<LiveStats> live;
     try {
-        for (const auto& entry : fs::recursive_directory_iterator(root_dir)) {
-            if (fs::is_regular_file(entry.path()))
-                files.push_back(entry.path());
+        if (!opts.stats_shm.empty()) live.reset(new LiveStats(opts.stats_shm));
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    try {
+        if (!opts.files_from.empty()) {
+            // Paths are streamed from the manifest below; nothing to walk.
+        } else if (!opts.state_file.empty()) {
+            state.load(opts.state_file);
+            state.walk(opts.root_dir, files, replayed, metrics.get());
+        } else {
+            auto step = std::chrono::steady_clock::now();
+            for (const auto& entry : fs::recursive_directory_iterator(opts.root_dir)) {
+                uint64_t size = 0, inode = 0, dev = 0;
+                errno = 0;
+                if (regularFileSize(entry.path(), size, &inode, &dev))
+                    files.push_back({entry.path(), size, inode, dev});
+                const int error = errno;                    // stat failed
+                if (error) forensics.addError(error, entry.path());
+                if (metrics) {
+                    if (error) metrics->addError(error);
+                    metrics->record(Phase::Walk, step);
+                    step = std::chrono::steady_clock::now();
+                }
+                if (live && files.size() % 1024 == 0)
+                    live->publish([&](crypty_stats::Totals& totals) { totals.filesQueued = files.size(); });
+            }
         }
     } catch (const std::exception& e) {
         std::cerr << "Error traversing directory: " << e.what() << "\n";
         return 1;
     }
 
+    // SIGINT/SIGTERM cancel the scan cooperatively; --stop-on-first cancels
+    // it at the first hit. Either way queued files are skipped, not scanned.
+    CancellationToken cancel;
+    std::atomic<bool> infectedFound{!replayed.empty()};
+    if (opts.stop_on_first && infectedFound) cancel.cancel();
+    std::signal(SIGINT, onTerminate);
+    std::signal(SIGTERM, onTerminate);
+
     std::mutex output_mutex;
-    ThreadPool pool(std::thread::hardware_concurrency());
+    std::vector<std::pair<fs::path, StopReason>> incomplete;
+    // --numa: each sweep task is queued on the node of the storage controller
+    // behind its file's device, looked up once per device. The worker that
+    // runs the task also does its reads; there are no separate I/O queues.
+    NumaTopology topology;
+    std::map<uint64_t, int> deviceNodes;
+    auto nodeFor = [&](const ScanItem& item) {
+        if (!opts.numa) return -1;
+        auto it = deviceNodes.find(item.dev);
+        if (it == deviceNodes.end())
+            it = deviceNodes.emplace(item.dev, topology.storageNode(static_cast<dev_t>(item.dev))).first;
+        return it->second;
+    };
+    int storageNode = -1;
+    if (opts.numa) {
+        topology = NumaTopology::detect();
+        struct stat st;
+        if (!opts.root_dir.empty() && ::stat(opts.root_dir.c_str(), &st) == 0)
+            storageNode = topology.storageNode(st.st_dev);
+        std::cout << "NUMA: " << topology.nodes() << " node(s), storage on "
+                  << (storageNode < 0 ? std::string("unknown node")
+                                      : "node " + std::to_string(topology.ids[storageNode]))
+                  << ".\n";
+    }
 
-    for (const auto& path : files) {
-        pool.submit([&, path]() {
-            try {
-                if (!isELFFile(path)) return;
+    // From here to the summary, hits go through the writer. stdout is flushed
+    // first so they cannot overtake what was printed before.
+    std::cout.flush();
+    OutputWriter results(STDOUT_FILENO);
+    auto printHit = [&results](const fs::path& path) {
+        thread_local std::string line;
+        line.assign("!!! File ");
+        appendQuoted(line, path.string());
+        line.append(" is infected!\n");
+        results.write(line);
+    };
+
+    std::vector<std::unique_ptr<ReportWriter>> reports;
+    try {
+        const uint64_t signatureId = fnv1a(FNV_OFFSET, signature.data(), signature.size());
+        if (!opts.jsonl_file.empty())
+            reports.emplace_back(new ReportWriter(opts.jsonl_file, ReportFormat::Jsonl, signatureId));
+        if (!opts.csv_file.empty())
+            reports.emplace_back(new ReportWriter(opts.csv_file, ReportFormat::Csv, signatureId));
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    for (const auto& path : replayed) {
+        printHit(path);
+        FileResult result(path);
+        result.cached = true;
+        regularFileSize(path, result.size, &result.inode);
+        for (auto& report : reports) report->add(result);
+    }
+
+    {
+        // --adaptive: enough threads for the deepest setting; the controller
+        // decides how many of them have a file at any time.
+        const size_t maxInFlight = opts.max_inflight ? opts.max_inflight : 4 * hardwareThreads();
+        TaskGroup scan;     // before the engine, so its workers are joined before it goes
+        ScanEngine engine(signature,
+                          opts.adaptive ? std::max(maxInFlight, opts.min_inflight) : hardwareThreads(),
+                          opts.numa ? &topology : nullptr, [&output_mutex](const char* what) {
+                              std::lock_guard<std::mutex> lock(output_mutex);
+                              std::cerr << "Error: Task failed: " << what << "\n";
+                          });
+        ThreadPool& pool = engine.threadPool();
+        std::unique_ptr<ConcurrencyController> controller;
+        if (opts.adaptive && !opts.pipeline)    // the pipeline sizes its stages itself
+            controller.reset(new ConcurrencyController(
+                scan, opts.min_inflight, maxInFlight, hardwareThreads(), [&]() {
+                    if (g_terminate) cancel.cancel();
+                    return cancel.cancelled();
+                }));
+        uint64_t filesQueued = 0, bytesQueued = 0;
+        auto started = std::chrono::steady_clock::now();
+
+        FileResultFn onDone = [&](const FileResult& result) {
+            PhaseTimer timer(metrics.get(),
+                             trace && trace->sampled(result.inode) ? trace.get() : nullptr,
+                             result.inode, Phase::Report);
+            if (result.hit >= 0) printHit(result.path);
+            for (auto& report : reports) report->add(result);
+            if (metrics) metrics->addFile(result.elf, result.bytesRead, result.hit >= 0, result.error);
+            forensics.add(result);
+            if (live) live->fileDone(result.bytesRead, result.hit >= 0);
+            std::lock_guard<std::mutex> lock(output_mutex);
+            if (result.hit >= 0) {
+                state.addInfected(result.path);
+                infectedFound = true;
+                if (opts.stop_on_first) cancel.cancel();
+            } else if (result.reason != StopReason::None) {
+                incomplete.emplace_back(result.path, result.reason);
+            }
+        };
+        auto makeLimits = [&](const ScanItem& item) {
+            ScanLimits limits;
+            limits.token = &cancel;
+            limits.pool = &pool;
+            if (opts.file_timeout_ms > 0)
+                limits.deadline = std::chrono::steady_clock::now() +
+                                  std::chrono::milliseconds(opts.file_timeout_ms);
+            if (opts.file_max_mib > 0)
+                limits.maxBytes = static_cast<uint64_t>(opts.file_max_mib) << 20;
+            if (controller) limits.readSize = controller->readSize();
+            limits.metrics = metrics.get();
+            if (trace && trace->sampled(item.inode)) limits.trace = trace.get();
+            limits.fileId = item.inode;
+            limits.live = live.get();
+            limits.file = &item.path;
+            limits.perf = perf.get();
+            limits.fileSize = item.size;
+            if (forensics.timesPhases()) limits.phases = std::make_shared<FilePhases>();
+            return limits;
+        };
+        const uint64_t splitBytes = static_cast<uint64_t>(opts.split_mib) << 20;
+
+        std::unique_ptr<ScanPipeline> pipeline;
+        if (opts.pipeline) pipeline.reset(new ScanPipeline(signature, opts.stage_threads, onDone));
+#ifdef CRYPTY_COROUTINES
+        // I/O threads bound the reads actually outstanding; the in-flight
+        // limit bounds the coroutine frames.
+        std::unique_ptr<CoroutineCore> coroutines;
+        if (opts.coroutines && !pipeline)
+            coroutines.reset(new CoroutineCore(pool, 4 * hardwareThreads(),
+                                               opts.max_inflight ? opts.max_inflight : 1024,
+                                               scan, signature, onDone));
+#endif
+
+        // A file skipped without being read still gets its report record.
+        auto skipped = [&](const ScanItem& item, StopReason reason) {
+            FileResult result(item.path, -1, reason);
+            result.size = item.size;
+            result.inode = item.inode;
+            onDone(result);
+        };
+
+        // --stats-shm: totals are also published while files are still being
+        // dispatched, which is most of the scan when dispatch blocks (--pipeline).
+        auto lastLive = started;
+        uint64_t lastLiveBytes = 0;
+        auto publishLive = [&](const TaskGroup::Progress& p, std::chrono::steady_clock::time_point now) {
+            const double secs = std::chrono::duration<double>(now - lastLive).count();
+            live->publish([&](crypty_stats::Totals& totals) {
+                totals.filesQueued = filesQueued;
+                totals.bytesQueued = bytesQueued;
+                totals.filesDone = p.filesDone;
+                totals.bytesDone = p.bytesDone;
+                totals.bytesPerSec =
+                    secs > 0 ? static_cast<uint64_t>((p.bytesDone - lastLiveBytes) / secs) : 0;
+                totals.pending = p.pending;
+                totals.running = p.running;
+                totals.pipeline = pipeline != nullptr;
+                if (pipeline) pipeline->stageDepths(totals.stageDepth);
+            });
+            lastLive = now;
+            lastLiveBytes = p.bytesDone;
+        };
+        auto liveTick = [&]() {
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastLive >= std::chrono::milliseconds(100))
+                publishLive(pipeline ? pipeline->progress() : scan.progress(), now);
+        };
 
-                if (containsSignatureBuffered(path, signature)) {
+        // One sweep task: a file from the scheduler, on a pool worker.
+        auto scanItem = [&](const ScanItem& item) {
+            // Queued work drains without I/O once the scan is cancelled.
+            if (cancel.cancelled()) {
+                skipped(item, StopReason::Cancelled);
+                scan.addFile(0);
+                return;
+            }
+            auto started = std::chrono::steady_clock::now();
+            FileResult result(item.path);
+            result.size = item.size;
+            result.inode = item.inode;
+            uint64_t counted = item.size;
+            try {
+                ScanLimits limits = makeLimits(item);
+                if (splitBytes > 0 && item.size >= splitBytes) {
+                    engine.scanSplit(item, limits, &scan, onDone);
+                    return;
+                }
+                engine.scanPath(item.path, limits, result);
+                // Stopped early: count what was read, not the whole file.
+                if (limits.stopped != StopReason::None) counted = limits.bytesRead;
+            } catch (const std::exception& e) {
+                {
                     std::lock_guard<std::mutex> lock(output_mutex);
-                    std::cout << "!!! File " << path << " is infected!\n";
+                    std::cerr << "Error scanning " << item.path << ": " << e.what() << "\n";
                 }
+                result.setError(scanFailureError());
+            }
+            result.setElapsed(started);
+            onDone(result);
+            scan.addFile(counted);
+        };
 
-            } catch (const std::exception& e) {
-                std::lock_guard<std::mutex> lock(output_mutex);
-                std::cerr << "Error scanning " << path << ": " << e.what() << "\n";
+        SizeScheduler scheduler(opts.lookahead, [&](ScanItem&& item) {
+            // A file skipped here still counts as done, or admit() would
+            // wait for it forever.
+            ++filesQueued;
+            bytesQueued += item.size;
+            if (cancel.cancelled()) {
+                skipped(item, StopReason::Cancelled);
+                if (pipeline) pipeline->skip(0);
+                else scan.addFile(0);
+                return;
+            }
+            if (controller) controller->admit(filesQueued - 1);
+            if (pipeline) {
+                pipeline->submit(item, makeLimits(item));
+                return;
+            }
+#ifdef CRYPTY_COROUTINES
+            if (coroutines) {
+                coroutines->scan(item, makeLimits(item));
+                return;
             }
+#endif
+            const int node = nodeFor(item);
+            pool.submit([&scanItem, item = std::move(item)]() { scanItem(item); },
+                        &scan, Priority::Normal, node);
         });
+
+        std::vector<ScanItem> batch;
+        auto submitBatch = [&]() {
+            if (batch.empty()) return;
+            if (controller) controller->admit(filesQueued);
+            filesQueued += batch.size();
+            for (const auto& item : batch) bytesQueued += item.size;
+            const int node = nodeFor(batch.front());    // filled in walk order: one device, mostly
+            pool.submit([&, batch = std::move(batch)]() {
+                ScanBuffer buffer(SMALL_FILE + 1);
+                for (const auto& item : batch) {
+                    if (cancel.cancelled()) {
+                        skipped(item, StopReason::Cancelled);
+                        scan.addFile(0);
+                        continue;
+                    }
+                    auto started = std::chrono::steady_clock::now();
+                    FileResult result(item.path);
+                    result.size = item.size;
+                    result.inode = item.inode;
+                    try {
+                        ScanLimits limits = makeLimits(item);
+                        limits.engine = Engine::Batch;
+                        engine.scanSmall(item.path, buffer.data(), SMALL_FILE + 1, limits, result);
+                    } catch (const std::exception& e) {
+                        {
+                            std::lock_guard<std::mutex> lock(output_mutex);
+                            std::cerr << "Error scanning " << item.path << ": " << e.what() << "\n";
+                        }
+                        result.setError(scanFailureError());
+                    }
+                    result.setElapsed(started);
+                    onDone(result);
+                    scan.addFile(item.size);
+                }
+            }, &scan, Priority::Normal, node);
+            batch.clear();
+        };
+
+        // Files too short for the ELF magic are counted without being opened;
+        // small ones are batched (plain task pool only), the rest go through the
+        // size-ordering window.
+        auto route = [&](ScanItem item) {
+            if (item.size < ELF_MAGIC_SIZE) {
+                ++filesQueued;
+                bytesQueued += item.size;
+                skipped(item, StopReason::None);
+                if (pipeline) pipeline->skip(item.size);
+                else scan.addFile(item.size);
+                return;
+            }
+            if (opts.batch > 1 && !pipeline && !opts.coroutines && item.size < SMALL_FILE) {
+                batch.push_back(std::move(item));
+                if (batch.size() >= opts.batch) submitBatch();
+                return;
+            }
+            scheduler.push(std::move(item));
+        };
+
+        if (!opts.files_from.empty()) {
+            std::ifstream manifest;
+            if (opts.files_from != "-") {
+                manifest.open(opts.files_from, std::ios::binary);
+                if (!manifest) {
+                    std::cerr << "Error: Cannot open manifest: " << opts.files_from << "\n";
+                    return 1;
+                }
+            }
+            std::istream& in = opts.files_from == "-" ? std::cin : manifest;
+
+            std::string entry;
+            while (readManifestEntry(in, entry, opts.null_delimited)) {
+                // Manifests from diffs list deleted files too; skip them quietly.
+                ScanItem item;
+                if (regularFileSize(entry, item.size, &item.inode, &item.dev)) {
+                    item.path = entry;
+                    route(std::move(item));
+                }
+                if (live) liveTick();
+                if (g_terminate) cancel.cancel();
+            }
+        } else {
+            for (auto& item : files) {
+                route(std::move(item));
+                if (live) liveTick();
+                if (g_terminate) cancel.cancel();
+            }
+        }
+        submitBatch();
+        scheduler.flush();
+
+        auto lastProgress = started, lastMetrics = started;
+        auto writeMetrics = [&](std::chrono::steady_clock::time_point now) {
+            lastMetrics = now;
+            if (!metrics->writePrometheus(opts.metrics_file,
+                                          std::chrono::duration<double>(now - started).count()))
+                std::cerr << "Error: Cannot write metrics to " << opts.metrics_file << "\n";
+        };
+        auto onProgress = [&](const TaskGroup::Progress& p) {
+            if (g_terminate) cancel.cancel();
+            if (controller) controller->sample();
+            auto now = std::chrono::steady_clock::now();
+            if (live) publishLive(p, now);
+            if (!opts.metrics_file.empty() &&
+                now - lastMetrics >= std::chrono::seconds(opts.metrics_interval_s))
+                writeMetrics(now);
+            if (opts.progress && now - lastProgress >= std::chrono::seconds(1)) {
+                lastProgress = now;
+                printProgress(p, filesQueued, bytesQueued, now - started);
+                if (pipeline) std::cerr << pipeline->stageSummary() << "\n";
+            }
+        };
+        if (pipeline) pipeline->wait(onProgress, std::chrono::milliseconds(100));
+        else scan.wait(onProgress, std::chrono::milliseconds(100));
+
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        results.flush();
+        for (auto& report : reports) report->flush();
+        TaskGroup::Progress done = pipeline ? pipeline->progress() : scan.progress();
+        if (live) publishLive(done, std::chrono::steady_clock::now());
+        std::cout << "\nScanned " << done.filesDone << " files, " << std::fixed << std::setprecision(1)
+                  << done.bytesDone / 1048576.0 << " MiB in " << std::setprecision(2) << elapsed << " s ("
+                  << std::setprecision(1) << (elapsed > 0 ? done.bytesDone / 1048576.0 / elapsed : 0.0)
+                  << " MiB/s).\n";
+        std::cout.unsetf(std::ios::floatfield);
+        if (pipeline) std::cout << pipeline->stageSummary() << "\n";
+        if (controller)
+            std::cout << "Adaptive: " << controller->limit() << " files in flight, "
+                      << controller->readSize() / 1024 << " KiB reads at the end.\n";
+        if (!opts.metrics_file.empty()) writeMetrics(std::chrono::steady_clock::now());
+        if (opts.stats) metrics->printSummary(std::cout, elapsed);
+        if (perf) perf->printSummary(std::cout);
+        forensics.printReport(std::cout);
+        if (engine.failures())
+            std::cerr << "Error: " << engine.failures()
+                      << " scan tasks failed; their files are missing from the results.\n";
+        if (trace && !trace->write(opts.trace_file))
+            std::cerr << "Error: Cannot write trace to " << opts.trace_file << "\n";
     }
 
-    // Destructor of ThreadPool will wait for all threads
+    if (!incomplete.empty())
+        reportIncomplete(incomplete, opts.unscanned_file);
+
+    if (!opts.state_file.empty()) {
+        std::cout << "\nDirectories: " << state.directoriesSeen()
+                  << ", pruned: " << state.directoriesPruned()
+                  << ", unchanged subtrees: " << state.subtreesUnchanged() << "\n";
+        // Files that were skipped must not be remembered as clean.
+        if (!incomplete.empty()) {
+            std::cerr << "State not saved: the scan did not cover every file.\n";
+        } else {
+            try {
+                state.save(opts.state_file);
+            } catch (const std::exception& e) {
+                std::cerr << "Error: " << e.what() << "\n";
+            }
+        }
+    }
+
+    if (opts.stop_on_first) {
+        std::cout << "\nScan " << (cancel.cancelled() ? "stopped" : "completed") << ".\n";
+        return infectedFound ? 2 : (incomplete.empty() ? 0 : 3);
+    }
     std::cout << "\nScan completed.\n";
-    std::cin.get();
+    if (opts.files_from != "-") std::cin.get();
     return 0;
 }
+#endif  // CRYPTY_LIBRARY
@@ -9,6 +9,13 @@
 #include <cstdlib>
 #include <stdexcept>
 #include <algorithm> 
+#include <mutex>
+#include <cerrno>
+#include <dlfcn.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "crypty.h"
 
 namespace fs = std::filesystem;
 
@@ -48,6 +55,7 @@ std::map<std::string, std::vector<uint8_t>> generate_test_cases() {
         {"partial_signature", make_elf_with({ 'c', 'r', 'y' }, 200)},
         {"non_elf", std::vector<uint8_t>{'N', 'O', 'T', '_', 'E', 'L', 'F'}},
         {"empty", {}},
+        {"truncated_magic", std::vector<uint8_t>{0x7F, 'E', 'L'}},
         {"huge_file", [] {
             std::vector<uint8_t> data = ELF_MAGIC;
             data.resize(10 * BUFFER_SIZE, 'A');
@@ -81,29 +89,48 @@ void build_test_tree(const fs::path& base_dir) {
 }
 
 // Scanner runner
-std::set<std::string> run_detector(const fs::path& scanner, const fs::path& base_dir) {
+std::set<std::string> run_scanner_command(std::string cmd, const fs::path& output_file);
+
+std::set<std::string> run_detector(const fs::path& scanner, const fs::path& base_dir,
+                                   const std::string& extra_args = "") {
     const fs::path output_file = base_dir / "scanner_output.txt";
-    std::string cmd = scanner.string() + " " + (base_dir / "samples").string() + " " +
-                      (base_dir / "sig.sig").string() + " > " + output_file.string();
-    int result = std::system(cmd.c_str());
-    if (result != 0) throw std::runtime_error("Scanner failed.");
+    std::string cmd = scanner.string() + " " + extra_args + (base_dir / "samples").string() + " " +
+                      (base_dir / "sig.sig").string();
+    return run_scanner_command(cmd, output_file);
+}
 
+// Number of times each path was reported infected in a scanner output file.
+std::map<std::string, size_t> count_reports(const fs::path& output_file) {
     std::ifstream in(output_file);
     if (!in) throw std::runtime_error("Cannot read scanner output.");
 
-    std::set<std::string> reported;
+    std::map<std::string, size_t> reported;
     std::string line;
     while (std::getline(in, line)) {
         if (line.find("is infected!") != std::string::npos) {
             size_t pos = line.find("File ");
             if (pos != std::string::npos) {
-                reported.insert(line.substr(pos + 5));
+                // Paths are printed quoted: !!! File "<path>" is infected!
+                std::string path = line.substr(pos + 5, line.rfind(" is infected!") - pos - 5);
+                if (path.size() >= 2 && path.front() == '"' && path.back() == '"')
+                    path = path.substr(1, path.size() - 2);
+                ++reported[path];
             }
         }
     }
     return reported;
 }
 
+std::set<std::string> run_scanner_command(std::string cmd, const fs::path& output_file) {
+    cmd += " > " + output_file.string();
+    int result = std::system(cmd.c_str());
+    if (result != 0) throw std::runtime_error("Scanner failed.");
+
+    std::set<std::string> reported;
+    for (const auto& [path, count] : count_reports(output_file)) reported.insert(path);
+    return reported;
+}
+
 // Before you create expected set:
 std::set<std::string> normalize_paths(const std::vector<fs::path>& paths) {
     std::set<std::string> normalized;
@@ -115,18 +142,18 @@ std::set<std::string> normalize_paths(const std::vector<fs::path>& paths) {
     return normalized;
 }
 
-void validate_results(const fs::path& base_dir, const std::set<std::string>& reported) {
-    std::vector<fs::path> expected_paths = {
+std::vector<fs::path> expected_infected(const fs::path& base_dir) {
+    return {
         base_dir / "samples" / "infected_middle",
         base_dir / "samples" / "infected_start",
         base_dir / "samples" / "infected_end",
         base_dir / "samples" / "infected_cross_boundary",
         base_dir / "samples" / "huge_file"
     };
+}
 
+bool compare_results(const std::vector<fs::path>& expected_paths, const std::set<std::string>& reported) {
     auto expected = normalize_paths(expected_paths);
-
-    std::cout << "=== Test Results ===\n";
     bool passed = true;
 
     for (const auto& path : expected) {
@@ -144,6 +171,27 @@ void validate_results(const fs::path& base_dir, const std::set<std::string>& rep
             passed = false;
         }
     }
+    return passed;
+}
+
+// Each expected path reported exactly once, and nothing else.
+bool check_reported_once(const std::vector<fs::path>& expected,
+                         const std::map<std::string, size_t>& counts) {
+    std::set<std::string> reported;
+    bool passed = true;
+    for (const auto& [path, count] : counts) {
+        reported.insert(path);
+        if (count != 1) {
+            std::cout << "[FAIL] Reported " << count << " times: " << path << "\n";
+            passed = false;
+        }
+    }
+    return compare_results(expected, reported) && passed;
+}
+
+void validate_results(const fs::path& base_dir, const std::set<std::string>& reported) {
+    std::cout << "=== Test Results ===\n";
+    bool passed = compare_results(expected_infected(base_dir), reported);
 
     if (passed) {
         std::cout << "\n✅ All tests passed.\n";
@@ -152,18 +200,604 @@ void validate_results(const fs::path& base_dir, const std::set<std::string>& rep
     }
 }
 
+// Incremental scan (--state): unchanged directories are pruned and their hits
+// replayed; a deliberately perturbed tree must still yield every infection.
+void test_incremental(const fs::path& scanner, const fs::path& base_dir) {
+    const fs::path inc_dir = base_dir / "incremental";
+    const fs::path state = inc_dir / "scan.state";
+    fs::remove_all(inc_dir);
+    fs::create_directories(inc_dir / "samples" / "nested" / "deeper");
+    write_binary_file(inc_dir / "sig.sig", SIGNATURE);
+
+    auto tests = generate_test_cases();
+    for (const auto& [name, content] : tests) {
+        write_binary_file(inc_dir / "samples" / name, content);
+    }
+    write_binary_file(inc_dir / "samples" / "nested" / "deeper" / "deep_infected", make_elf_with(SIGNATURE, 64));
+    write_binary_file(inc_dir / "samples" / "nested" / "clean_nested", make_elf_with({}, 64));
+
+    std::vector<fs::path> expected = expected_infected(inc_dir);
+    expected.push_back(inc_dir / "samples" / "nested" / "deeper" / "deep_infected");
+
+    const std::string args = "--state " + state.string() + " ";
+    std::cout << "\n=== Incremental Scan ===\n";
+    bool passed = compare_results(expected, run_detector(scanner, inc_dir, args));
+    passed = compare_results(expected, run_detector(scanner, inc_dir, args)) && passed;
+
+    // Perturb: replace a clean file via rename, add an infected file to a new
+    // subdirectory, and delete an infected file.
+    write_binary_file(inc_dir / "samples" / "nested" / "clean_nested.tmp", make_elf_with(SIGNATURE, 32));
+    fs::rename(inc_dir / "samples" / "nested" / "clean_nested.tmp", inc_dir / "samples" / "nested" / "clean_nested");
+    fs::create_directories(inc_dir / "samples" / "added");
+    write_binary_file(inc_dir / "samples" / "added" / "new_infected", make_elf_with(SIGNATURE, 8));
+    fs::remove(inc_dir / "samples" / "nested" / "deeper" / "deep_infected");
+
+    expected.pop_back();
+    expected.push_back(inc_dir / "samples" / "nested" / "clean_nested");
+    expected.push_back(inc_dir / "samples" / "added" / "new_infected");
+    passed = compare_results(expected, run_detector(scanner, inc_dir, args)) && passed;
+
+    // Rewrite a clean file in place: its directory's own stamp is unchanged.
+    write_binary_file(inc_dir / "samples" / "clean", make_elf_with(SIGNATURE, 100));
+    expected.push_back(inc_dir / "samples" / "clean");
+    passed = compare_results(expected, run_detector(scanner, inc_dir, args)) && passed;
+
+    std::cout << (passed ? "\n✅ Incremental tests passed.\n" : "\n❌ Incremental tests failed.\n");
+}
+
+// Watch mode (--watch): files written after the initial scan are scanned
+// once, including inside a directory renamed while watched; the rename
+// itself does not rescan the files it moved.
+void test_watch(const fs::path& scanner, const fs::path& base_dir) {
+    const fs::path watch_dir = base_dir / "watch", samples = watch_dir / "samples";
+    const fs::path pid = watch_dir / "watch.pid", output = watch_dir / "watch_output.txt";
+    fs::remove_all(watch_dir);
+    fs::create_directories(samples / "sub");
+    write_binary_file(watch_dir / "sig.sig", SIGNATURE);
+    write_binary_file(samples / "sub" / "old_infected", make_elf_with(SIGNATURE, 16));
+
+    std::cout << "\n=== Watch Mode ===\n";
+    std::system(("sh -c 'echo $$ > " + pid.string() + "; exec " + scanner.string() +
+                 " --watch --debounce-ms 50 " + samples.string() + " " +
+                 (watch_dir / "sig.sig").string() + "' > " + output.string() + " 2>&1 &").c_str());
+    auto output_has = [&](const std::string& text) {
+        std::ifstream in(output);
+        std::string all((std::istreambuf_iterator<char>(in)), {});
+        return all.find(text) != std::string::npos;
+    };
+    for (int i = 0; i < 100 && !output_has("Watching for changes"); ++i) std::system("sleep 0.05");
+
+    write_binary_file(samples / "new_infected", make_elf_with(SIGNATURE, 8));
+    std::system("sleep 0.3");
+    fs::rename(samples / "sub", samples / "moved");
+    std::system("sleep 0.2");
+    write_binary_file(samples / "moved" / "after_move", make_elf_with(SIGNATURE, 8));
+    std::system("sleep 0.5");
+    std::system(("kill $(cat " + pid.string() + "); while kill -0 $(cat " + pid.string() +
+                 ") 2>/dev/null; do sleep 0.05; done").c_str());
+
+    bool passed = check_reported_once({samples / "sub" / "old_infected", samples / "new_infected",
+                                       samples / "moved" / "after_move"},
+                                      count_reports(output));
+    std::cout << (passed ? "\n✅ Watch tests passed.\n" : "\n❌ Watch tests failed.\n");
+    fs::remove_all(watch_dir);
+}
+
+// Manifest input (--files-from): only the listed files are scanned, no walk.
+void test_manifest(const fs::path& scanner, const fs::path& base_dir) {
+    const fs::path samples = base_dir / "samples";
+    const std::vector<fs::path> listed = {
+        samples / "infected_middle", samples / "clean", samples / "huge_file",
+        samples / "non_elf", samples / "does_not_exist"
+    };
+    const std::vector<fs::path> expected = {samples / "infected_middle", samples / "huge_file"};
+
+    std::string newline_list, nul_list;
+    for (const auto& p : listed) {
+        newline_list += p.string() + "\n";
+        nul_list += p.string() + '\0';
+    }
+    write_binary_file(base_dir / "manifest.txt", {newline_list.begin(), newline_list.end()});
+    write_binary_file(base_dir / "manifest.nul", {nul_list.begin(), nul_list.end()});
+
+    const fs::path output_file = base_dir / "scanner_output.txt";
+    const std::string sig = " " + (base_dir / "sig.sig").string();
+    std::cout << "\n=== Manifest Input ===\n";
+    bool passed = compare_results(expected, run_scanner_command(
+        scanner.string() + " --files-from " + (base_dir / "manifest.txt").string() + sig, output_file));
+    passed = compare_results(expected, run_scanner_command(
+        scanner.string() + " --null --files-from -" + sig + " < " + (base_dir / "manifest.nul").string(),
+        output_file)) && passed;
+
+    std::cout << (passed ? "\n✅ Manifest tests passed.\n" : "\n❌ Manifest tests failed.\n");
+}
+
+// Lookahead (--lookahead): files held in the window are dispatched largest
+// first. One in-flight file on one worker makes dispatch order visible as
+// report order.
+void test_lookahead(const fs::path& scanner, const fs::path& base_dir) {
+    const fs::path dir = base_dir / "lookahead";
+    fs::remove_all(dir);
+    fs::create_directories(dir / "samples");
+    write_binary_file(dir / "sig.sig", SIGNATURE);
+
+    const std::vector<std::pair<std::string, size_t>> files = {
+        {"a_small", 1000}, {"b_huge", 90000}, {"c_medium", 20000}, {"d_large", 60000}, {"e_tiny", 100}
+    };
+    for (const auto& [name, padding] : files)
+        write_binary_file(dir / "samples" / name, make_elf_with(SIGNATURE, padding));
+
+    std::cout << "\n=== Lookahead ===\n";
+    run_detector(scanner, dir, "--adaptive --min-inflight 1 --max-inflight 1 --batch 0 --lookahead 16 ");
+    std::vector<std::string> order;
+    std::ifstream in(dir / "scanner_output.txt");
+    for (std::string line; std::getline(in, line);) {
+        size_t start = line.find("File \""), end = line.rfind("\" is infected!");
+        if (start != std::string::npos && end != std::string::npos)
+            order.push_back(fs::path(line.substr(start + 6, end - start - 6)).filename().string());
+    }
+    const std::vector<std::string> expected = {"b_huge", "d_large", "c_medium", "a_small", "e_tiny"};
+    bool passed = order == expected;
+    std::cout << (passed ? "[OK] " : "[FAIL] ") << "Dispatch order:";
+    for (const auto& name : order) std::cout << " " << name;
+    std::cout << (passed ? "\n\n✅ Lookahead tests passed.\n" : "\n\n❌ Lookahead tests failed.\n");
+    fs::remove_all(dir);
+}
+
+// Writes `content` at `offset` into an existing file.
+void patch_file(const fs::path& path, uint64_t offset, const std::vector<uint8_t>& content) {
+    std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!f) throw std::runtime_error("Cannot patch file: " + path.string());
+    f.seekp(static_cast<std::streamoff>(offset));
+    f.write(reinterpret_cast<const char*>(content.data()), content.size());
+}
+
+// Split scanning (--split-mib): large sparse ELFs are scanned as 64 MiB
+// ranges; hits on and around range boundaries must be found exactly once,
+// and a file with two hits reports the first, even when the later range
+// finds its hit sooner.
+void test_split(const fs::path& scanner, const fs::path& base_dir) {
+    constexpr uint64_t RANGE = 64ULL << 20;
+    const fs::path split_dir = base_dir / "split";
+    fs::remove_all(split_dir);
+    fs::create_directories(split_dir / "samples");
+    write_binary_file(split_dir / "sig.sig", SIGNATURE);
+
+    const std::vector<std::pair<std::string, int64_t>> cases = {
+        {"straddles_boundary", static_cast<int64_t>(RANGE) - 3},
+        {"starts_at_boundary", static_cast<int64_t>(RANGE)},
+        {"ends_at_boundary", static_cast<int64_t>(RANGE - SIGNATURE.size())},
+        {"at_file_end", static_cast<int64_t>(3 * RANGE - SIGNATURE.size())},
+        {"clean_large", -1},
+    };
+    std::vector<fs::path> expected;
+    for (const auto& [name, offset] : cases) {
+        const fs::path file = split_dir / "samples" / name;
+        write_binary_file(file, ELF_MAGIC);
+        fs::resize_file(file, 3 * RANGE);
+        if (offset >= 0) {
+            patch_file(file, static_cast<uint64_t>(offset), SIGNATURE);
+            expected.push_back(file);
+        }
+    }
+    const fs::path two = split_dir / "samples" / "two_matches";
+    const uint64_t first = RANGE - 100;
+    write_binary_file(two, ELF_MAGIC);
+    fs::resize_file(two, 3 * RANGE);
+    patch_file(two, first, SIGNATURE);
+    patch_file(two, RANGE + 10, SIGNATURE);
+    expected.push_back(two);
+
+    std::cout << "\n=== Split Scan ===\n";
+    const fs::path output = split_dir / "scanner_output.txt", jsonl = split_dir / "report.jsonl";
+    run_detector(scanner, split_dir, "--split-mib 1 --jsonl " + jsonl.string() + " ");
+    bool passed = check_reported_once(expected, count_reports(output));
+    bool firstMatch = false;
+    std::ifstream report(jsonl);
+    for (std::string line; std::getline(report, line);)
+        if (line.find("two_matches") != std::string::npos)
+            firstMatch = line.find("\"matches\":[" + std::to_string(first) + "]") != std::string::npos;
+    std::cout << (firstMatch ? "[OK] " : "[FAIL] ") << "First of two matches reported\n";
+    passed = passed && firstMatch;
+    // The pipeline's read chunks end on the same boundaries.
+    run_detector(scanner, split_dir, "--pipeline ");
+    passed = check_reported_once(expected, count_reports(output)) && passed;
+    std::cout << (passed ? "\n✅ Split tests passed.\n" : "\n❌ Split tests failed.\n");
+    fs::remove_all(split_dir);
+}
+
+// Stop on first (--stop-on-first) under --adaptive: one file in flight, so
+// files are still waiting for a slot when the first hit cancels the scan.
+// The scan must end with exit code 2 and one hit, not wait for the slots.
+void test_stop_on_first(const fs::path& scanner, const fs::path& base_dir) {
+    const fs::path output = base_dir / "scanner_output.txt";
+    const std::string cmd = "timeout -k 5 60 " + scanner.string() +
+                            " --adaptive --max-inflight 1 --batch 0 --lookahead 0 --stop-on-first " +
+                            (base_dir / "samples").string() + " " + (base_dir / "sig.sig").string() +
+                            " > " + output.string() + " 2>&1";
+    std::cout << "\n=== Stop On First ===\n";
+    const int status = std::system(cmd.c_str());
+    const int code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    bool passed = code == 2;
+    std::cout << (passed ? "[OK] " : "[FAIL] ") << "Exit code " << code
+              << (code == 124 ? " (timed out)" : "") << "\n";
+    size_t hits = 0;
+    for (const auto& [path, count] : count_reports(output)) hits += count;
+    passed = hits == 1 && passed;
+    std::cout << (hits == 1 ? "[OK] " : "[FAIL] ") << hits << " hit(s) reported\n";
+    std::cout << (passed ? "\n✅ Stop tests passed.\n" : "\n❌ Stop tests failed.\n");
+}
+
+// Staged pipeline (--pipeline): same hits as the task pool, both with the
+// default stage sizes and with a single thread per stage.
+void test_pipeline(const fs::path& scanner, const fs::path& base_dir) {
+    const std::vector<fs::path> expected = expected_infected(base_dir);
+    std::cout << "\n=== Pipeline ===\n";
+    bool passed = compare_results(expected, run_detector(scanner, base_dir, "--pipeline "));
+    passed = compare_results(expected, run_detector(scanner, base_dir,
+                                                    "--pipeline --stage-threads 1,1,1 ")) && passed;
+    std::cout << (passed ? "\n✅ Pipeline tests passed.\n" : "\n❌ Pipeline tests failed.\n");
+}
+
+// Coroutine core (--coroutines): same hits as the task pool. A C++17 build
+// of the scanner ignores the option, so build it as C++20 to cover the core.
+void test_coroutines(const fs::path& scanner, const fs::path& base_dir) {
+    std::cout << "\n=== Coroutine Core ===\n";
+    bool passed = compare_results(expected_infected(base_dir),
+                                  run_detector(scanner, base_dir, "--coroutines "));
+    std::cout << (passed ? "\n✅ Coroutine tests passed.\n" : "\n❌ Coroutine tests failed.\n");
+}
+
+// Runs cmd through sh and returns the peak resident set of it and its
+// children in KiB, or -1 if it could not be run or failed.
+long peak_rss_kib(const std::string& cmd) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", cmd.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    int status = 0;
+    struct rusage usage;
+    if (pid < 0 || wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0)
+        return -1;
+    return usage.ru_maxrss;
+}
+
+// Structured reports (--jsonl, --csv): one record per sample, and the
+// infected records name exactly the expected files. Test paths need no
+// escaping, so the path is the first quoted field of each record.
+void test_reports(const fs::path& scanner, const fs::path& base_dir) {
+    const fs::path jsonl = base_dir / "report.jsonl";
+    const fs::path csv = base_dir / "report.csv";
+    run_detector(scanner, base_dir,
+                 "--jsonl " + jsonl.string() + " --csv " + csv.string() + " ");
+
+    size_t samples = std::distance(fs::directory_iterator(base_dir / "samples"),
+                                   fs::directory_iterator());
+    std::cout << "\n=== Structured Reports ===\n";
+    bool passed = true;
+    for (const auto& [file, infectedTag] :
+         {std::make_pair(jsonl, std::string("\"status\":\"infected\"")),
+          std::make_pair(csv, std::string(",infected,"))}) {
+        std::ifstream in(file);
+        std::set<std::string> infected;
+        size_t records = 0;
+        std::string line;
+        if (file == csv) std::getline(in, line);    // header
+        while (std::getline(in, line)) {
+            ++records;
+            size_t open = line.find('"', file == jsonl ? line.find("\"path\":") + 7 : 0);
+            size_t close = line.find('"', open + 1);
+            std::string path = line.substr(open + 1, close - open - 1);
+            if (line.find(infectedTag) != std::string::npos) infected.insert(path);
+            // The signature sits right after the magic in infected_start.
+            if (path.size() >= 15 && path.compare(path.size() - 15, 15, "/infected_start") == 0 &&
+                line.find(file == jsonl ? "\"matches\":[4]" : ",4,") == std::string::npos) {
+                std::cout << "[FAIL] Wrong match offset: " << line << "\n";
+                passed = false;
+            }
+        }
+        if (records != samples) {
+            std::cout << "[FAIL] " << file.filename() << ": " << records << " records for "
+                      << samples << " files\n";
+            passed = false;
+        }
+        passed = compare_results(expected_infected(base_dir), infected) && passed;
+    }
+
+    // Both reports at once on many files: each thread keeps one output ring
+    // per report, so peak memory must not grow with the file count.
+    const fs::path many = base_dir / "many";
+    fs::remove_all(many);
+    fs::create_directories(many / "samples");
+    write_binary_file(many / "sig.sig", SIGNATURE);
+    for (int i = 0; i < 2000; ++i)
+        write_binary_file(many / "samples" / ("f" + std::to_string(i)), make_elf_with({}, 16));
+    const long rss = peak_rss_kib(scanner.string() + " --jsonl " + jsonl.string() + " --csv " +
+                                  csv.string() + " " + (many / "samples").string() + " " +
+                                  (many / "sig.sig").string() + " > /dev/null < /dev/null");
+    const bool bounded = rss > 0 && rss < 64 * 1024;
+    std::cout << (bounded ? "[OK] " : "[FAIL] ") << "Peak RSS with both reports on 2000 files: "
+              << rss / 1024 << " MiB\n";
+    passed = bounded && passed;
+    fs::remove_all(many);
+
+    std::cout << (passed ? "\n✅ Report tests passed.\n" : "\n❌ Report tests failed.\n");
+    fs::remove(jsonl);
+    fs::remove(csv);
+}
+
+// Metrics (--metrics): the Prometheus textfile counts every sample and
+// every expected hit.
+void test_metrics(const fs::path& scanner, const fs::path& base_dir) {
+    const fs::path prom = base_dir / "crypty.prom";
+    run_detector(scanner, base_dir, "--stats --metrics " + prom.string() + " ");
+
+    const size_t samples = std::distance(fs::directory_iterator(base_dir / "samples"),
+                                         fs::directory_iterator());
+    std::map<std::string, std::string> values;
+    std::ifstream in(prom);
+    std::string name, value;
+    while (in >> name >> value) {
+        if (name == "#") std::getline(in, value);
+        else values[name] = value;
+    }
+
+    std::cout << "\n=== Metrics ===\n";
+    bool passed = true;
+    for (const auto& [metric, expected] :
+         {std::make_pair(std::string("crypty_files_total"), std::to_string(samples)),
+          std::make_pair(std::string("crypty_hits_total"),
+                         std::to_string(expected_infected(base_dir).size()))}) {
+        bool ok = values[metric] == expected;
+        std::cout << (ok ? "[OK] " : "[FAIL] ") << metric << " = " << values[metric]
+                  << " (expected " << expected << ")\n";
+        passed = passed && ok;
+    }
+    std::cout << (passed ? "\n✅ Metrics tests passed.\n" : "\n❌ Metrics tests failed.\n");
+    fs::remove(prom);
+}
+
+// Tracing (--trace): every sample gets exactly one report span in the
+// Chrome trace JSON.
+void test_trace(const fs::path& scanner, const fs::path& base_dir) {
+    const fs::path trace = base_dir / "trace.json";
+    run_detector(scanner, base_dir, "--trace " + trace.string() + " ");
 
+    const size_t samples = std::distance(fs::directory_iterator(base_dir / "samples"),
+                                         fs::directory_iterator());
+    std::ifstream in(trace);
+    std::string json((std::istreambuf_iterator<char>(in)), {});
+    size_t reports = 0;
+    for (size_t pos = 0; (pos = json.find("\"name\":\"report\"", pos)) != std::string::npos; ++pos)
+        ++reports;
 
+    std::cout << "\n=== Tracing ===\n";
+    bool passed = json.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[") == 0 &&
+                  json.find("]}") != std::string::npos && reports == samples;
+    std::cout << (passed ? "[OK] " : "[FAIL] ") << reports << " report spans for " << samples
+              << " files\n";
+    std::cout << (passed ? "\n✅ Trace tests passed.\n" : "\n❌ Trace tests failed.\n");
+    fs::remove(trace);
+}
+
+// Live stats (--stats-shm): crypty-top, built next to the scanner, reads
+// the segment while the scan waits on its manifest, and the scanner
+// removes the segment when it exits.
+void test_live_stats(const fs::path& scanner, const fs::path& base_dir) {
+    const fs::path top = scanner.parent_path() / "crypty-top";
+    std::cout << "\n=== Live Stats ===\n";
+    if (!fs::exists(top)) {
+        std::cout << "[SKIP] " << top << " not built\n";
+        return;
+    }
+    const std::string name = "/crypty-test-" + std::to_string(::getpid());
+    const fs::path segment = "/dev/shm" + name, output = base_dir / "top_output.txt";
+    const fs::path done = base_dir / "live_done";
+    fs::remove(done);
+    std::system(("{ (sleep 1; find " + (base_dir / "samples").string() + " -type f) | " +
+                 scanner.string() + " --files-from - --stats-shm " + name + " " +
+                 (base_dir / "sig.sig").string() + " > /dev/null 2>&1; touch " + done.string() +
+                 "; } &").c_str());
+    for (int i = 0; i < 100 && !fs::exists(segment); ++i) std::system("sleep 0.05");
+
+    std::system((top.string() + " --once " + name + " > " + output.string() + " 2>&1").c_str());
+    std::ifstream in(output);
+    std::string text((std::istreambuf_iterator<char>(in)), {});
+    bool passed = text.find("crypty scan, pid ") == 0;
+    std::cout << (passed ? "[OK] " : "[FAIL] ") << "crypty-top read the stats block\n";
+
+    for (int i = 0; i < 200 && !fs::exists(done); ++i) std::system("sleep 0.05");
+    bool removed = fs::exists(done) && !fs::exists(segment);
+    std::cout << (removed ? "[OK] " : "[FAIL] ") << "Segment removed on exit\n";
+    passed = passed && removed;
+    std::cout << (passed ? "\n✅ Live stats tests passed.\n" : "\n❌ Live stats tests failed.\n");
+    fs::remove(output);
+    fs::remove(done);
+}
+
+// Hardware counters (--perf-counters): results are unchanged and the
+// scan ends with the counter table, or with why there is none (no PMU).
+void test_perf_counters(const fs::path& scanner, const fs::path& base_dir) {
+    auto reported = run_detector(scanner, base_dir, "--perf-counters ");
+    std::ifstream in(base_dir / "scanner_output.txt");
+    std::string output((std::istreambuf_iterator<char>(in)), {});
+
+    std::cout << "\n=== Hardware Counters ===\n";
+    bool printed = output.find("Hardware counters while matching") != std::string::npos ||
+                   output.find("Hardware counters unavailable: ") != std::string::npos;
+    std::cout << (printed ? "[OK] " : "[FAIL] ") << "Counter summary printed\n";
+    bool passed = compare_results(expected_infected(base_dir), reported) && printed;
+    std::cout << (passed ? "\n✅ Hardware counter tests passed.\n"
+                         : "\n❌ Hardware counter tests failed.\n");
+}
+
+// Forensics (--slowest): the report lists that many scanned files, and a
+// file that cannot be opened is reported unreadable, not clean. The second
+// check needs a user that permissions apply to.
+void test_forensics(const fs::path& scanner, const fs::path& base_dir) {
+    const fs::path dir = base_dir / "forensics";
+    fs::remove_all(dir);
+    fs::create_directories(dir / "samples");
+    write_binary_file(dir / "sig.sig", SIGNATURE);
+    for (const auto& [name, content] : generate_test_cases())
+        write_binary_file(dir / "samples" / name, content);
+    const fs::path locked = dir / "samples" / "locked_infected";
+    write_binary_file(locked, make_elf_with(SIGNATURE, 16));
+    fs::permissions(locked, fs::perms::none);
+
+    std::cout << "\n=== Forensics ===\n";
+    auto reported = run_detector(scanner, dir, "--slowest 3 ");
+    std::ifstream in(dir / "scanner_output.txt");
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(in, line);) lines.push_back(line);
+
+    auto heading = std::find_if(lines.begin(), lines.end(), [](const std::string& line) {
+        return line.rfind("Slowest files", 0) == 0;
+    });
+    size_t listed = 0;
+    if (heading != lines.end())
+        for (auto it = heading + 1; it != lines.end() && !it->empty(); ++it)
+            listed += it->find((dir / "samples").string()) != std::string::npos;
+    bool passed = listed == 3;
+    std::cout << (passed ? "[OK] " : "[FAIL] ") << listed << " slowest files listed\n";
+
+    if (std::ifstream(locked)) {
+        std::cout << "[SKIP] Unreadable file check: running with access to every file\n";
+    } else {
+        bool unreadable = !reported.count(locked.string()) &&
+                          std::find(lines.begin(), lines.end(),
+                                    "Not fully scanned: 1 files (1 unreadable)") != lines.end();
+        std::cout << (unreadable ? "[OK] " : "[FAIL] ") << "Unreadable file reported\n";
+        passed = passed && unreadable;
+    }
+    fs::permissions(locked, fs::perms::owner_all);
+    std::cout << (passed ? "\n✅ Forensics tests passed.\n" : "\n❌ Forensics tests failed.\n");
+}
+
+// Daemon (--daemon): a resident scanner answers crypty-scan, built next to
+// the scanner, with the same verdicts as a one-shot run.
+void test_daemon(const fs::path& scanner, const fs::path& base_dir) {
+    const fs::path client = scanner.parent_path() / "crypty-scan";
+    std::cout << "\n=== Daemon ===\n";
+    if (!fs::exists(client)) {
+        std::cout << "[SKIP] " << client << " not built\n";
+        return;
+    }
+    const fs::path socket = base_dir / "crypty.sock", pid = base_dir / "daemon.pid";
+    const fs::path output = base_dir / "daemon_output.txt";
+    std::system(("sh -c 'echo $$ > " + pid.string() + "; exec " + scanner.string() + " --daemon " +
+                 socket.string() + " " + (base_dir / "sig.sig").string() + "' > " +
+                 (base_dir / "daemon.log").string() + " 2>&1 &").c_str());
+    for (int i = 0; i < 100 && !fs::exists(socket); ++i) std::system("sleep 0.05");
+
+    std::system((client.string() + " --socket " + socket.string() + " " +
+                 (base_dir / "samples").string() + " > " + output.string()).c_str());
+    std::system(("kill $(cat " + pid.string() + ")").c_str());
+
+    std::set<std::string> reported;
+    size_t lines = 0;
+    std::ifstream in(output);
+    for (std::string line; std::getline(in, line); ++lines) {
+        size_t found = line.rfind("\": FOUND ");
+        if (line.size() > 1 && line[0] == '"' && found != std::string::npos)
+            reported.insert(line.substr(1, found - 1));
+    }
+    const size_t samples = std::distance(fs::directory_iterator(base_dir / "samples"),
+                                         fs::directory_iterator());
+    bool passed = lines == samples;
+    std::cout << (passed ? "[OK] " : "[FAIL] ") << lines << " replies for " << samples << " files\n";
+    passed = compare_results(expected_infected(base_dir), reported) && passed;
+    std::cout << (passed ? "\n✅ Daemon tests passed.\n" : "\n❌ Daemon tests failed.\n");
+    fs::remove(output);
+    fs::remove(pid);
+}
+
+// Library (libcrypty.so, built next to the scanner): blocking and submitted
+// scans through the C ABI agree with the scanner, and memory scans report
+// the match offset.
+struct Library {
+    void* handle = nullptr;
+    template <typename F>
+    F get(const char* name) { return reinterpret_cast<F>(dlsym(handle, name)); }
+};
+
+void collect_infected(void* user, const char* name, const crypty_result* result) {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (result->status == CRYPTY_INFECTED) static_cast<std::set<std::string>*>(user)->insert(name);
+}
+
+void test_library(const fs::path& scanner, const fs::path& base_dir) {
+    const fs::path path = scanner.parent_path() / "libcrypty.so";
+    std::cout << "\n=== Library ===\n";
+    Library lib;
+    if (!fs::exists(path) || !(lib.handle = dlopen(path.c_str(), RTLD_NOW))) {
+        std::cout << "[SKIP] " << path << " not built\n";
+        return;
+    }
+    auto create = lib.get<int (*)(const char*, unsigned, crypty_engine**)>("crypty_engine_create_from_file");
+    auto destroy = lib.get<void (*)(crypty_engine*)>("crypty_engine_destroy");
+    auto scan_path = lib.get<int (*)(crypty_engine*, const char*, crypty_result*)>("crypty_scan_path");
+    auto scan_buffer = lib.get<int (*)(crypty_engine*, const void*, size_t, crypty_result*)>("crypty_scan_buffer");
+    auto submit_path = lib.get<int (*)(crypty_engine*, const char*, crypty_callback, void*)>("crypty_submit_path");
+    auto wait = lib.get<void (*)(crypty_engine*)>("crypty_wait");
+
+    crypty_engine* engine = nullptr;
+    bool passed = create((base_dir / "sig.sig").c_str(), 2, &engine) == 0;
+    std::set<std::string> scanned, submitted;
+    for (const auto& entry : fs::directory_iterator(base_dir / "samples")) {
+        const std::string file = entry.path().string();
+        if (scan_path(engine, file.c_str(), nullptr) == CRYPTY_INFECTED) scanned.insert(file);
+        passed = submit_path(engine, file.c_str(), collect_infected, &submitted) == 0 && passed;
+    }
+    wait(engine);
+    passed = compare_results(expected_infected(base_dir), scanned) && passed;
+    passed = compare_results(expected_infected(base_dir), submitted) && passed;
+
+    crypty_result result;
+    const auto elf = make_elf_with(SIGNATURE, 10);
+    bool found = scan_buffer(engine, elf.data(), elf.size(), &result) == CRYPTY_INFECTED &&
+                 result.offset == 14;
+    found = scan_buffer(engine, SIGNATURE.data(), SIGNATURE.size(), &result) == CRYPTY_CLEAN &&
+            result.elf_class == -1 && found;
+    std::cout << (found ? "[OK] " : "[FAIL] ") << "Buffer scans\n";
+    found = scan_path(engine, (base_dir / "missing").c_str(), &result) == CRYPTY_ERROR &&
+            result.error == ENOENT;
+    std::cout << (found ? "[OK] " : "[FAIL] ") << "Missing file is an error\n";
+    destroy(engine);
+    dlclose(lib.handle);
+    std::cout << (passed && found ? "\n✅ Library tests passed.\n" : "\n❌ Library tests failed.\n");
+}
 
 // Entry
-int main() {
+int main(int argc, char* argv[]) {
     fs::path base_dir = "C:/Users/TESTUSER/OneDrive/Documents/aqua/project/tests";
     fs::path scanner = "./find_sig.exe";
+    if (argc > 1) base_dir = argv[1];
+    if (argc > 2) scanner = argv[2];
 
     try {
         build_test_tree(base_dir);
         auto reported = run_detector(scanner, base_dir);
         validate_results(base_dir, reported);
+        test_incremental(scanner, base_dir);
+        test_watch(scanner, base_dir);
+        test_manifest(scanner, base_dir);
+        test_lookahead(scanner, base_dir);
+        test_split(scanner, base_dir);
+        test_stop_on_first(scanner, base_dir);
+        test_pipeline(scanner, base_dir);
+        test_coroutines(scanner, base_dir);
+        test_reports(scanner, base_dir);
+        test_metrics(scanner, base_dir);
+        test_trace(scanner, base_dir);
+        test_live_stats(scanner, base_dir);
+        test_perf_counters(scanner, base_dir);
+        test_forensics(scanner, base_dir);
+        test_daemon(scanner, base_dir);
+        test_library(scanner, base_dir);
     } catch (const std::exception& ex) {
         std::cerr << "Test failed with exception: " << ex.what() << "\n";
         return 1;